@@ -7,7 +7,14 @@ Tests for the AVLTree class.=
 */
 
 #include "library.h"
+#include "concurrenttree.h"
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
 #include <fstream>
+#include <sstream>
+#include <thread>
 
 int main() {
 	int error = 0;
@@ -19,6 +26,21 @@ int main() {
 		Book book(line);
 		lib.insert(book);
 	};
+
+	/* Loading the file gives the same books as inserting its lines */
+	Library fromFile;
+	std::vector<CatalogError> errors;
+	std::ostringstream inserted;
+	std::ostringstream readText;
+	for (const Book& b : lib.range(0, ULONG_MAX))
+		inserted << b << "\n";
+	bool sameLoad = fromFile.load("exemple_librairie_a.txt", errors) && errors.empty() && fromFile == lib;
+	for (const Book& b : fromFile.range(0, ULONG_MAX))
+		readText << b << "\n";
+	if (!sameLoad || readText.str() != inserted.str() || fromFile.total_copies() != lib.total_copies()) {
+		std::cerr << "FAILURE - 0" << std::endl;
+		error++;
+	}
 	std::string book_str_1 = "The broom of the system;9784062061612;David Foster Wallace;19";
 	Book book_1(book_str_1);
 	std::string book_str_2 = "The Promise;9780399161490;Robert Crais;17";
@@ -65,6 +87,705 @@ int main() {
 		std::cerr << "FAILURE - V" << std::endl;
 		error++;
 	}
+	// Writers racing on the same few ISBNs of a ConcurrentAVLTree.
+	ConcurrentAVLTree<Book> shared;
+	const unsigned WRITERS = 4;
+	const int KEYS = 8;
+	const int ROUNDS = 2000;
+	std::vector<std::thread> writers;
+	for (unsigned w = 0; w < WRITERS; w++) {
+		writers.push_back(std::thread([&shared]() {
+			for (int r = 0; r < ROUNDS; r++)
+				shared.insert(Book(9780000000000UL + r % KEYS, "Author", "Title", 1));
+		}));
+	}
+	for (std::thread& t : writers)
+		t.join();
+	writers.clear();
+	bool counted = shared.size() == KEYS;
+	for (int k = 0; k < KEYS; k++) {
+		std::optional<Book> found = shared.lookup(9780000000000UL + k);
+		if (!found || found->copies() != (int)WRITERS * ROUNDS / KEYS)
+			counted = false;
+	}
+	if (!counted) {
+		std::cerr << "FAILURE - VI" << std::endl;
+		error++;
+	}
+	std::atomic<bool> consistent(true);
+	for (unsigned w = 0; w < WRITERS; w++) {
+		writers.push_back(std::thread([&shared, &consistent, w]() {
+			for (int r = 0; r < ROUNDS; r++) {
+				unsigned long isbn = 9780000000000UL + (r * 7 + w) % KEYS;
+				if ((r + w) % 3 == 0)
+					shared.remove(Book(isbn));
+				else
+					shared.insert(Book(isbn, "Author", "Title", 1));
+				std::optional<Book> found = shared.lookup(isbn);
+				if (found && (*found != Book(isbn) || found->copies() < 1))
+					consistent = false;
+			}
+		}));
+	}
+	for (std::thread& t : writers)
+		t.join();
+	int present = 0;
+	std::optional<Book> previous;
+	shared.for_each([&](const Book& b) {
+		std::optional<Book> found = shared.lookup(b);
+		if (!found || found->copies() != b.copies() || (previous && !(*previous < b)))
+			consistent = false;
+		previous.emplace(b);
+		present++;
+	});
+	if (!consistent || present != shared.size()) {
+		std::cerr << "FAILURE - VII" << std::endl;
+		error++;
+	}
+
+	/* Malformed lines are skipped and reported with their number */
+	{
+		std::ofstream out("avl-library-test.txt", std::ios::binary);
+		out << "Good;9780000000001;Author A;3\n"
+			<< "No separator 9780000000002\n"
+			<< "\n"
+			<< "Bad ISBN;97800x;Author;2\n"
+			<< "Bad total;9780000000005;Author;two\n"
+			<< "Carriage return;9780000000006;Author B;4\r\n";
+	}
+	Library parsed;
+	std::vector<CatalogError> parseErrors;
+	bool opened = parsed.load("avl-library-test.txt", parseErrors);
+	if (!opened || parseErrors.size() != 3 ||
+		parseErrors[0].line != 2 || parseErrors[1].line != 4 || parseErrors[2].line != 5 ||
+		parsed.count_range(0, ULONG_MAX) != 2 ||
+		parsed.find(9780000000001UL).copies() != 3 ||
+		parsed.find(9780000000006UL).copies() != 4 ||
+		parsed.by_author("Author B").size() != 1) {
+		std::cerr << "FAILURE - VIII" << std::endl;
+		error++;
+	}
+	/* Same through a stream */
+	std::istringstream stream("Good;9780000000001;Author A;3\nNo separator 9780000000002\n\n"
+		"Bad ISBN;97800x;Author;2\nBad total;9780000000005;Author;two\nCarriage return;9780000000006;Author B;4\r\n");
+	Library streamedParsed;
+	std::vector<CatalogError> streamErrors;
+	streamedParsed.load(stream, streamErrors);
+	if (streamErrors.size() != 3 ||
+		streamErrors[0].line != 2 || streamErrors[1].line != 4 || streamErrors[2].line != 5 ||
+		streamErrors[1].message != parseErrors[1].message ||
+		!(streamedParsed == parsed) || streamedParsed.find(9780000000006UL).copies() != 4) {
+		std::cerr << "FAILURE - VIII" << std::endl;
+		error++;
+	}
+	/* Same with a catalog split into chunks parsed on several threads */
+	{
+		std::ofstream out("avl-library-test.txt", std::ios::binary);
+		for (int i = 1; i <= 50000; i++) {
+			if (i % 10000 == 7)
+				out << "Broken line " << i << '\n';
+			else
+				out << "Title " << i << ';' << 9780000000000UL + i << ";Author " << i % 100 << ";1\n";
+		}
+	}
+	Library chunked;
+	parseErrors.clear();
+	opened = chunked.load("avl-library-test.txt", parseErrors, 4);
+	bool numbered = parseErrors.size() == 5;
+	for (size_t i = 0; numbered && i < parseErrors.size(); i++)
+		numbered = parseErrors[i].line == i * 10000 + 7;
+	if (!opened || !numbered || chunked.count_range(0, ULONG_MAX) != 49995) {
+		std::cerr << "FAILURE - IX" << std::endl;
+		error++;
+	}
+	std::remove("avl-library-test.txt");
+	std::vector<CatalogError> missingErrors;
+	if (Library().load("avl-library-missing.txt", missingErrors)) {
+		std::cerr << "FAILURE - X" << std::endl;
+		error++;
+	}
+
+	/* Loading, destroying and reloading a catalog frees its text */
+	size_t live = TextArena::live();
+	bool released = true;
+	for (int round = 0; round < 3; round++) {
+		{
+			Library loaded;
+			std::vector<CatalogError> loadErrors;
+			loaded.load("exemple_librairie_a.txt", loadErrors);
+			std::ifstream in("exemple_librairie_a.txt");
+			Library streamed;
+			streamed.load(in, loadErrors);
+			Library restored;
+			loaded.save("avl-library-test.snapshot");
+			restored.restore("avl-library-test.snapshot");
+			Library copy = loaded;
+			loaded = Library();
+			copy.insert(book_1);
+			copy.merge(streamed);
+			if (!(copy == restored) || copy.find(9784062061612UL).copies() != 57 || TextArena::live() == live)
+				released = false;
+		}
+		if (TextArena::live() != live)
+			released = false;
+	}
+	std::remove("avl-library-test.snapshot");
+	/* A Book copied out of a library keeps its text after the library is gone */
+	Book kept;
+	{
+		Library loaded;
+		std::vector<CatalogError> loadErrors;
+		loaded.load("exemple_librairie_a.txt", loadErrors);
+		kept = loaded.find(9784062061612UL);
+	}
+	std::ostringstream printed;
+	printed << kept;
+	if (printed.str() != "9784062061612 [ copies : 19 ]\n\tDavid Foster Wallace - The broom of the system")
+		released = false;
+	kept = Book();
+	/* Books built on their own free their text with their last copy */
+	for (int i = 0; i < 1000; i++) {
+		Book single(9780000000000UL + i, "Author", "Title " + std::to_string(i), 1);
+		Book copy = single;
+		Book moved = std::move(single);
+	}
+	if (TextArena::live() != live)
+		released = false;
+	if (!released) {
+		std::cerr << "FAILURE - XI" << std::endl;
+		error++;
+	}
+
+	/* A snapshot restores the same books, a corrupted one is rejected */
+	Library restored;
+	bool roundTrip = lib.save("avl-library-test.snapshot") && restored.restore("avl-library-test.snapshot") && restored == lib;
+	Library::Iterator copied = restored.lower_bound(0);
+	for (const Book& b : lib.range(0, ULONG_MAX)) {
+		std::ostringstream expected, actual;
+		expected << b;
+		actual << *copied;
+		if (expected.str() != actual.str() || b.copies() != copied->copies())
+			roundTrip = false;
+		++copied;
+	}
+	std::string bytes;
+	{
+		std::ifstream in("avl-library-test.snapshot", std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	/* The offsets below need a header and at least one record */
+	if (bytes.size() < sizeof(SnapshotHeader) + sizeof(SnapshotRecord)) {
+		roundTrip = false;
+	}
+	else {
+		size_t corruptions[] = { sizeof(SnapshotHeader) + offsetof(SnapshotRecord, total), bytes.size() - 1, bytes.size() / 2 };
+		for (size_t offset : corruptions) {
+			std::string corrupted = bytes;
+			corrupted[offset] ^= 0x20;
+			std::ofstream out("avl-library-test.snapshot", std::ios::binary | std::ios::trunc);
+			out.write(corrupted.data(), corrupted.size());
+			out.close();
+			if (restored.restore("avl-library-test.snapshot"))
+				roundTrip = false;
+		}
+		{
+			std::ofstream out("avl-library-test.snapshot", std::ios::binary | std::ios::trunc);
+			out.write(bytes.data(), bytes.size() - 1);
+		}
+		if (restored.restore("avl-library-test.snapshot") || !(restored == lib) || restored.total(book_1) != lib.total(book_1))
+			roundTrip = false;
+	}
+	std::remove("avl-library-test.snapshot");
+	if (!roundTrip) {
+		std::cerr << "FAILURE - XII" << std::endl;
+		error++;
+	}
+
+	/* A frozen copy answers lookups like find */
+	FrozenTree<Book> frozen = lib.freeze();
+	bool agree = frozen.size() == lib.count_range(0, ULONG_MAX);
+	for (const Book& b : lib.range(0, ULONG_MAX)) {
+		const Book* found = frozen.lookup(b);
+		if (found == nullptr || found->copies() != b.copies())
+			agree = false;
+	}
+	FrozenTree<Book> frozenChunked = chunked.freeze();
+	for (unsigned long k = 0; k <= 50001; k++) {
+		const Book* found = frozenChunked.lookup(9780000000000UL + k);
+		if ((found ? found->copies() : 0) != chunked.find(9780000000000UL + k).copies())
+			agree = false;
+	}
+	if (!agree || Library().freeze().lookup(9780000000001UL) != nullptr) {
+		std::cerr << "FAILURE - XIII" << std::endl;
+		error++;
+	}
+
+	/* Batched lookups answer like find, in the order of the keys */
+	std::vector<unsigned long> keys;
+	for (long k = 50001; k >= 0; k -= 3)
+		keys.push_back(9780000000000UL + k);
+	keys.push_back(9780000000001UL);
+	std::vector<const Book*> batch(keys.size());
+	std::unique_ptr<bool[]> contained(new bool[keys.size()]);
+	chunked.find_batch(keys.data(), keys.size(), batch.data());
+	chunked.contains_batch(keys.data(), keys.size(), contained.get());
+	bool batched = true;
+	for (size_t i = 0; i < keys.size(); i++) {
+		const Book& expected = chunked.find(keys[i]);
+		if ((batch[i] != nullptr) != contained[i] ||
+			(batch[i] == nullptr ? expected.copies() != 0 : batch[i] != &expected))
+			batched = false;
+	}
+	if (!batched) {
+		std::cerr << "FAILURE - XIV" << std::endl;
+		error++;
+	}
+
+	/* Index queries return the same books as a scan, before and after updates */
+	Library indexed = chunked;
+	indexed.set_indexes(Library::AUTHOR_INDEX | Library::TITLE_INDEX);
+	Book added(9780000099999UL, "Author 42", "Title 12345 bis", 2);
+	Book dropped(9780000000142UL);
+	auto describe = [](const std::vector<const Book*>& books) {
+		std::ostringstream out;
+		for (const Book* b : books)
+			out << *b << '\n';
+		return out.str();
+	};
+	bool queried = indexed.indexes() == (Library::AUTHOR_INDEX | Library::TITLE_INDEX);
+	for (int round = 0; round < 2; round++) {
+		std::vector<const Book*> written = indexed.by_author("Author 42");
+		std::vector<const Book*> titled = indexed.by_title_prefix("Title 1234");
+		std::vector<const Book*> limited = indexed.by_title_prefix("Title 1234", 5);
+		queried = queried && written.size() == 500 &&
+			written.front() == &indexed.find(9780000000042UL) &&
+			describe(written) == describe(chunked.by_author("Author 42")) &&
+			titled.size() == (round == 0 ? 11u : 12u) &&
+			titled.front() == &indexed.find(9780000001234UL) &&
+			titled.back() == &indexed.find(9780000012349UL) &&
+			describe(titled) == describe(chunked.by_title_prefix("Title 1234")) &&
+			limited.size() == 5 && std::equal(limited.begin(), limited.end(), titled.begin()) &&
+			indexed.by_author("Nobody").empty() && indexed.by_title_prefix("Zzz").empty();
+		for (size_t i = 1; i < written.size(); i++)
+			queried = queried && *written[i - 1] < *written[i];
+		indexed.insert(added);
+		indexed.remove(dropped);
+		chunked.insert(added);
+		chunked.remove(dropped);
+	}
+	queried = queried && indexed.by_author("Author 42").size() == 500 &&
+		indexed.by_title_prefix("Title 12345 bis").size() == 1 &&
+		indexed.by_title_prefix("Title 142", 1).front() == &indexed.find(9780000001420UL);
+	if (!queried) {
+		std::cerr << "FAILURE - XV" << std::endl;
+		error++;
+	}
+
+	/* Merging books already present does not store their text again */
+	Library target;
+	Library source;
+	std::vector<CatalogError> mergeErrors;
+	target.load("exemple_librairie_a.txt", mergeErrors);
+	source.load("exemple_librairie_a.txt", mergeErrors);
+	size_t stored = target.memory_usage().shared;
+	target.merge(source);
+	target.merge(source);
+	if (target.memory_usage().shared != stored || target.total(book_1) != 57 || !(target == source)) {
+		std::cerr << "FAILURE - XVI" << std::endl;
+		error++;
+	}
+
+	/* Parallel traversals visit every element once, small trees and empty ones too */
+	bool traversed = true;
+	for (int n : { 0, 1000, 100000 }) {
+		AVLTree<int> numbers;
+		for (int i = 0; i < n; i++)
+			numbers.insert((int)((long long)i * 7919 % 100003));
+		std::vector<int> sorted(numbers.begin(), numbers.end());
+		long long expected = 0;
+		int even = 0;
+		for (int v : sorted) {
+			expected += v;
+			even += v % 2 == 0;
+		}
+		std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[100003]);
+		for (int v = 0; v < 100003; v++)
+			visits[v] = 0;
+		numbers.parallel_for_each([&](int v) { visits[v]++; }, 4);
+		int total = 0;
+		for (int v = 0; v < 100003; v++)
+			total += visits[v];
+		for (int v : sorted)
+			traversed = traversed && visits[v] == 1;
+		std::vector<int> ordered(n, -1);
+		numbers.parallel_for_each_ordered([&](int i, int v) { ordered[i] = v; }, 4);
+		traversed = traversed && total == n && ordered == sorted &&
+			numbers.parallel_transform_reduce(10LL, [](int v) { return 2LL * v; },
+				[](long long a, long long b) { return a + b; }, 4) == 10 + 2 * expected &&
+			numbers.parallel_count_if([](int v) { return v % 2 == 0; }, 4) == even &&
+			numbers.parallel_count_if([](int v) { return v % 2 == 0; }, 1) == even;
+	}
+	auto plenty = [](const Book& b) { return b.copies() > 30; };
+	long long copies = 0;
+	long long plentyCopies = 0;
+	int stocked = 0;
+	for (const Book& b : lib.range(0, ULONG_MAX)) {
+		copies += b.copies();
+		plentyCopies += plenty(b) ? b.copies() : 0;
+		stocked += plenty(b);
+	}
+	if (!traversed || stocked == 0 || lib.total_copies() != copies || lib.total_copies(4) != copies ||
+		lib.total_copies_if(plenty, 4) != plentyCopies || lib.count_if(plenty, 4) != stocked ||
+		Library().total_copies(4) != 0) {
+		std::cerr << "FAILURE - XVII" << std::endl;
+		error++;
+	}
+
+	/* Split, join and union keep the content, the balance and the counts of the nodes */
+	auto balanced = [](const AVLTree<int>& tree, const std::vector<int>& expected) {
+		std::vector<int> content(tree.begin(), tree.end());
+		if (content != expected || tree.size() != (int)expected.size())
+			return false;
+		for (size_t i = 0; i < content.size(); i++) {
+			int b = tree.balance(content[i]);
+			if (b < -1 || b > 1 || b != tree.get_balance(content[i]) || tree.rank(content[i]) != (int)i)
+				return false;
+		}
+		return true;
+	};
+	AVLTree<int> odds;
+	std::vector<int> oddValues;
+	std::vector<int> allValues;
+	for (int v = 0; v < 40000; v++) {
+		if (v % 2 == 1) {
+			odds.insert(v);
+			oddValues.push_back(v);
+		}
+		allValues.push_back(v);
+	}
+	AVLTree<int> upper;
+	odds.split(20001, upper);
+	std::vector<int> lowerValues(oddValues.begin(), oddValues.begin() + 10001);
+	std::vector<int> upperValues(oddValues.begin() + 10001, oddValues.end());
+	bool joined = balanced(odds, lowerValues) && balanced(upper, upperValues);
+	AVLTree<int> empty;
+	odds.split(-1, empty);
+	joined = joined && odds.isEmpty() && balanced(empty, lowerValues);
+	empty.join(upper);
+	joined = joined && upper.isEmpty() && balanced(empty, oddValues);
+	std::atomic<int> common(0);
+	auto meet = [&common](int& mine, int& theirs) { common += mine == theirs; };
+	AVLTree<int> evens;
+	for (int v = 0; v < 40000; v += 2)
+		evens.insert(v);
+	AVLTree<int> evensCopy(evens);
+	empty.union_with(evensCopy, meet, 1);
+	joined = joined && common == 0 && balanced(empty, allValues) && evensCopy.size() == 20000;
+	empty.union_with(std::move(evens), meet, 4);
+	joined = joined && common == 20000 && evens.isEmpty() && balanced(empty, allValues);
+	AVLTree<Book> stock;
+	AVLTree<Book> delivery;
+	for (int i = 0; i < 30000; i++) {
+		stock.insert(Book(9780000000000 + 2 * i, "Author", "Title", 1));
+		delivery.insert(Book(9780000000000 + 3 * i, "Author", "Title", 2));
+	}
+	stock.union_with(std::move(delivery), [](Book& mine, Book& theirs) { mine = theirs; }, 4);
+	int restocked = 0;
+	long long stockCopies = 0;
+	for (const Book& b : stock) {
+		restocked += b.copies() == 3;
+		stockCopies += b.copies();
+	}
+	if (!joined || stock.size() != 50000 || restocked != 10000 || stockCopies != 30000 + 60000 ||
+		stock.select(0)->copies() != 3 || !delivery.isEmpty()) {
+		std::cerr << "FAILURE - XVIII" << std::endl;
+		error++;
+	}
+
+	/* Bulk removals return the count removed and leave a balanced tree and clean indexes */
+	AVLTree<int> range;
+	std::vector<int> rangeValues;
+	for (int v = 0; v < 10000; v++) {
+		range.insert(v);
+		if (v < 1000 || v > 2999)
+			rangeValues.push_back(v);
+	}
+	bool removed = range.erase_range(1000, 2999) == 2000 && balanced(range, rangeValues) &&
+		range.erase_range(1000, 2999) == 0 && range.erase_range(5, 4) == 0 &&
+		range.erase_range(10000, 20000) == 0 && balanced(range, rangeValues);
+	std::vector<int> retainedValues;
+	for (int v : rangeValues) {
+		if (v % 3 != 0)
+			retainedValues.push_back(v);
+	}
+	removed = removed && range.retain_if([](int v) { return v % 3 != 0; }) == (int)(rangeValues.size() - retainedValues.size()) &&
+		balanced(range, retainedValues) && range.retain_if([](int) { return true; }) == 0 &&
+		range.retain_if([](int) { return false; }) == (int)retainedValues.size() && range.isEmpty();
+	Library pruned;
+	for (int i = 0; i < 3000; i++)
+		pruned.insert(Book(9780000000000UL + i, "Author " + std::to_string(i % 10), "Title " + std::to_string(i), i % 4 + 1));
+	pruned.set_indexes(Library::AUTHOR_INDEX | Library::TITLE_INDEX);
+	const Book* survivor = &pruned.find(9780000002501UL);
+	removed = removed && pruned.erase_range(9780000000100UL, 9780000000199UL) == 100 &&
+		pruned.erase_range(9780000000100UL, 9780000000199UL) == 0 &&
+		pruned.retain_if([](const Book& b) { return b.copies() != 1; }) == 725 &&
+		pruned.count_range(0, ULONG_MAX) == 2175 && &pruned.find(9780000002501UL) == survivor;
+	for (int i = 0; i < 3000; i++) {
+		bool kept = (i < 100 || i > 199) && i % 4 != 0;
+		if (pruned.contains(Book(9780000000000UL + i)) != kept)
+			removed = false;
+	}
+	for (int a = 0; a < 10; a++) {
+		std::vector<const Book*> written = pruned.by_author("Author " + std::to_string(a));
+		int expected = 0;
+		for (int i = a; i < 3000; i += 10)
+			expected += (i < 100 || i > 199) && i % 4 != 0;
+		if ((int)written.size() != expected)
+			removed = false;
+		for (const Book* b : written) {
+			if (!pruned.contains(*b))
+				removed = false;
+		}
+	}
+	std::vector<const Book*> titled = pruned.by_title_prefix("Title 1");
+	int titledExpected = 0;
+	for (int i = 1; i < 3000; i++) {
+		std::string title = "Title " + std::to_string(i);
+		titledExpected += title.compare(0, 7, "Title 1") == 0 && (i < 100 || i > 199) && i % 4 != 0;
+	}
+	if (!removed || (int)titled.size() != titledExpected) {
+		std::cerr << "FAILURE - XIX" << std::endl;
+		error++;
+	}
+
+	/* Extracting moves the element out and leaves the other nodes where they were */
+	AVLTree<int> extracted;
+	std::vector<int> extractedValues;
+	for (int v = 0; v < 1000; v++) {
+		extracted.insert(v);
+		extractedValues.push_back(v);
+	}
+	std::vector<const int*> addresses;
+	for (int v = 0; v < 1000; v++)
+		addresses.push_back(extracted.lookup(v));
+	bool moved = true;
+	/* Inner nodes have two children, so their successor is detached to take their place */
+	for (int v : { 511, 500, 250, 0, 999 }) {
+		std::optional<int> out = extracted.extract(v);
+		if (!out || *out != v || extracted.extract(v))
+			moved = false;
+		extractedValues.erase(std::find(extractedValues.begin(), extractedValues.end(), v));
+		addresses[v] = nullptr;
+	}
+	moved = moved && !extracted.extract(5000) && !extracted.extract(-1) && balanced(extracted, extractedValues);
+	for (int v = 0; v < 1000; v++) {
+		if (addresses[v] != nullptr && extracted.lookup(v) != addresses[v])
+			moved = false;
+	}
+	AVLTree<Book> shelf;
+	shelf.insert(Book(9780000000001UL, "Author", "First", 3));
+	shelf.insert(Book(9780000000002UL, "Author", "Second", 4));
+	shelf.insert(Book(9780000000003UL, "Author", "Third", 5));
+	const Book* third = shelf.lookup(9780000000003UL);
+	std::optional<Book> second = shelf.extract(9780000000002UL);
+	std::ostringstream secondText;
+	if (second)
+		secondText << *second;
+	if (!moved || !second || second->copies() != 4 || secondText.str() != "9780000000002 [ copies : 4 ]\n\tAuthor - Second" ||
+		shelf.extract(9780000000002UL) || shelf.lookup(9780000000003UL) != third || shelf.size() != 2) {
+		std::cerr << "FAILURE - XX" << std::endl;
+		error++;
+	}
+
+	/* Bounds, equal ranges and ISBN prefixes stop at the right books */
+	Library bounded;
+	for (unsigned long isbn : { 9780315999999UL, 9780316000000UL, 9780316123456UL, 9780316999999UL, 9780317000000UL })
+		bounded.insert(Book(isbn, "Author", "Title", 1));
+	auto listed = [](const Library::Range& r) {
+		std::vector<Book> found(r.begin(), r.end());
+		return found;
+	};
+	auto books = [](std::vector<unsigned long> keys) {
+		std::vector<Book> expected;
+		for (unsigned long isbn : keys)
+			expected.push_back(Book(isbn));
+		return expected;
+	};
+	std::vector<Book> middle = books({ 9780316000000UL, 9780316123456UL, 9780316999999UL });
+	bool bounds = listed(bounded.isbn_prefix(9780316)) == middle &&
+		listed(bounded.isbn_prefix(978031612345)) == books({ 9780316123456UL }) &&
+		listed(bounded.isbn_prefix(9780316123456)) == books({ 9780316123456UL }) &&
+		bounded.isbn_prefix(9780318).empty() && bounded.isbn_prefix(9780316123457).empty() &&
+		listed(bounded.range(9780316000000UL, 9780316999999UL)) == middle &&
+		bounded.range(9780316000001UL, 9780316123455UL).empty() && bounded.range(9780317000000UL, 9780316000000UL).empty() &&
+		bounded.lower_bound(0) == bounded.lower_bound(9780315999999UL) && bounded.lower_bound(0)->copies() == 1 &&
+		!bounded.lower_bound(9780317000001UL) && !bounded.upper_bound(9780317000000UL) &&
+		bounded.upper_bound(9780316000000UL) == bounded.lower_bound(9780316000001UL) &&
+		bounded.upper_bound(9780316000000UL) == bounded.lower_bound(9780316123456UL);
+	std::pair<Library::Iterator, Library::Iterator> hit = bounded.equal_range(9780316123456UL);
+	std::pair<Library::Iterator, Library::Iterator> miss = bounded.equal_range(9780316123457UL);
+	std::pair<Library::Iterator, Library::Iterator> highest = bounded.equal_range(9780317000000UL);
+	bounds = bounds && hit.first == bounded.lower_bound(9780316123456UL) && hit.second == bounded.lower_bound(9780316999999UL) &&
+		miss.first == miss.second && miss.first == bounded.lower_bound(9780316999999UL) &&
+		highest.first && !highest.second && Library().isbn_prefix(9780316).empty() && !Library().lower_bound(0);
+	AVLTree<int> bounds10;
+	for (int v = 0; v < 100; v += 10)
+		bounds10.insert(v);
+	AVLTree<int>::Range tens = bounds10.range(10, 30);
+	std::vector<int> tensValues(tens.begin(), tens.end());
+	bounds = bounds && tensValues == std::vector<int>({ 10, 20, 30 }) && bounds10.range(11, 19).empty() &&
+		bounds10.range(30, 10).empty() && bounds10.range(90, 1000).begin() != bounds10.range(90, 1000).end() &&
+		*bounds10.upper_bound(-5) == 0 && bounds10.upper_bound(90) == bounds10.end();
+	if (!bounds) {
+		std::cerr << "FAILURE - XXI" << std::endl;
+		error++;
+	}
+
+	/* rank and select are inverse of each other, select out of range finds nothing */
+	AVLTree<int> ranked;
+	for (int v = 2997; v >= 0; v -= 3)
+		ranked.insert(v);
+	bool ordered = ranked.select(-1) == nullptr && ranked.select(1000) == nullptr &&
+		AVLTree<int>().select(0) == nullptr && AVLTree<int>().rank(5) == 0 && ranked.rank(-1) == 0 && ranked.rank(5000) == 1000;
+	for (int k = 0; k < 1000; k++) {
+		const int* selected = ranked.select(k);
+		if (selected == nullptr || *selected != 3 * k || ranked.rank(*selected) != k || ranked.rank(3 * k + 1) != k + 1)
+			ordered = false;
+	}
+	ranked.erase_range(0, 1499);
+	for (int k = 0; k < 500; k++) {
+		if (ranked.select(k) == nullptr || ranked.rank(*ranked.select(k)) != k || *ranked.select(k) != 1500 + 3 * k)
+			ordered = false;
+	}
+	std::vector<unsigned long> boundedIsbns = { 9780315999999UL, 9780316000000UL, 9780316123456UL, 9780316999999UL, 9780317000000UL };
+	for (int k = 0; k < 5; k++) {
+		if (!(bounded.select(k) == Book(boundedIsbns[k])) || bounded.rank(boundedIsbns[k]) != k || bounded.select(k).copies() != 1)
+			ordered = false;
+	}
+	ordered = ordered && bounded.select(5) == Book() && bounded.select(5).copies() == 0 &&
+		bounded.select(-1) == Book() && Library().select(0).copies() == 0 && bounded.rank(9780316123457UL) == 3;
+	if (!ordered) {
+		std::cerr << "FAILURE - XXII" << std::endl;
+		error++;
+	}
+
+	/* Iterators walk backwards from end(), one element at a time */
+	AVLTree<int> backwards;
+	std::vector<int> forwardValues;
+	for (int i = 0; i < 1000; i++)
+		backwards.insert(i * 389 % 1000);
+	for (int v = 0; v < 1000; v++)
+		forwardValues.push_back(v);
+	std::vector<int> reversedValues(forwardValues.rbegin(), forwardValues.rend());
+	std::vector<int> walked;
+	AVLTree<int>::Iterator back = backwards.end();
+	for (int i = 0; i < 1000 && back != backwards.begin(); i++)
+		walked.push_back(*--back);
+	std::vector<int> reversed(std::make_reverse_iterator(backwards.end()), std::make_reverse_iterator(backwards.begin()));
+	AVLTree<int>::Iterator postfix = backwards.end();
+	postfix--;
+	AVLTree<int>::Iterator greatest = postfix--;
+	AVLTree<int>::Iterator middleIt = backwards.lower_bound(500);
+	--middleIt;
+	AVLTree<int>::Iterator first = backwards.begin();
+	AVLTree<int> single;
+	single.insert(7);
+	AVLTree<int>::Iterator alone = single.end();
+	--alone;
+	bool reverse = walked == reversedValues && reversed == reversedValues && *greatest == 999 && *postfix == 998 &&
+		*middleIt == 499 && !(--first) && alone && *alone == 7 && !(--alone) &&
+		std::vector<int>(std::make_reverse_iterator(single.end()), std::make_reverse_iterator(single.begin())) == std::vector<int>(1, 7);
+	AVLTree<int>::Range upperHalf = backwards.range(500, 999);
+	std::vector<int> upperReversed(std::make_reverse_iterator(upperHalf.end()), std::make_reverse_iterator(upperHalf.begin()));
+	if (!reverse || upperReversed != std::vector<int>(reversedValues.begin(), reversedValues.begin() + 500)) {
+		std::cerr << "FAILURE - XXIII" << std::endl;
+		error++;
+	}
+
+	/* Operation counters follow known operations and start again from zero after a reset */
+	AVLTree<int, NodePool, CountingStats> instrumented;
+	/* 3 under 5 under the root: one double rotation */
+	for (int v : { 1, 2, 3, 5, 4 })
+		instrumented.insert(v);
+	TreeStats afterInserts = instrumented.statistics();
+	const OperationStats& inserts = afterInserts.operations[OP_INSERT];
+	bool counting = inserts.calls == 5 && inserts.visits == 0 + 1 + 2 + 2 + 3 && inserts.comparisons > 0 &&
+		inserts.rotations == 1 && inserts.doubleRotations == 1 && inserts.allocations == 5 && inserts.frees == 0 &&
+		afterInserts.operations[OP_REMOVE].calls == 0 && afterInserts.operations[OP_LOOKUP].calls == 0;
+	/* Removing 1 from 2(1, 4(3, 5)) rotates 4 up once */
+	instrumented.remove(1);
+	instrumented.contains(4);
+	TreeStats used = instrumented.statistics();
+	counting = counting && used.operations[OP_INSERT].calls == 5 && used.operations[OP_REMOVE].calls == 1 &&
+		used.operations[OP_REMOVE].frees == 1 && used.operations[OP_REMOVE].rotations == 1 &&
+		used.operations[OP_LOOKUP].calls == 1 && used.operations[OP_LOOKUP].visits == 1 &&
+		used.total().calls == 7 && used.total().allocations == 5 && used.total().frees == 1;
+	instrumented.reset_statistics();
+	TreeStats cleared = instrumented.statistics();
+	counting = counting && cleared.total().calls == 0 && cleared.total().visits == 0 && cleared.total().comparisons == 0 &&
+		cleared.total().allocations == 0 && cleared.total().frees == 0 && cleared.total().rotations == 0;
+	instrumented.contains(5);
+	counting = counting && instrumented.statistics().total().calls == 1 && instrumented.statistics().operations[OP_LOOKUP].visits == 2;
+	Library measured;
+	measured.insert(Book(9780000000001UL, "Author", "Title", 1));
+	measured.insert(Book(9780000000002UL, "Author", "Title", 1));
+	measured.contains(Book(9780000000001UL));
+#ifdef AVL_STATISTICS
+	counting = counting && measured.statistics().operations[OP_INSERT].calls == 2 &&
+		measured.statistics().operations[OP_INSERT].allocations == 2 && measured.statistics().operations[OP_LOOKUP].calls >= 1;
+#else
+	counting = counting && measured.statistics().total().calls == 0;
+#endif
+	measured.reset_statistics();
+	if (!counting || measured.statistics().total().calls != 0) {
+		std::cerr << "FAILURE - XXIV" << std::endl;
+		error++;
+	}
+
+	/* Memory usage follows the catalog, its indexes and its text, down to nothing once cleared */
+	auto unused = [](const MemoryUsage& usage) {
+		return usage.elements == 0 && usage.nodes == 0 && usage.payload == 0 && usage.slack == 0 &&
+			usage.indexes == 0 && usage.shared == 0 && usage.total() == 0;
+	};
+	Library weighed;
+	bool accounted = unused(weighed.memory_usage());
+	std::vector<CatalogError> weighedErrors;
+	weighed.load("exemple_librairie_a.txt", weighedErrors);
+	MemoryUsage loadedUsage = weighed.memory_usage();
+	accounted = accounted && loadedUsage.elements == (size_t)weighed.count_range(0, ULONG_MAX) && loadedUsage.elements > 0 &&
+		loadedUsage.nodes > loadedUsage.elements * sizeof(Book) && loadedUsage.nodes % loadedUsage.elements == 0 &&
+		loadedUsage.payload == 0 && loadedUsage.indexes == 0 && loadedUsage.shared > 0 && loadedUsage.shared % TextArena::CHUNK == 0 &&
+		loadedUsage.total() == loadedUsage.nodes + loadedUsage.slack && loadedUsage.iterator == sizeof(Library::Iterator);
+	weighed.set_indexes(Library::AUTHOR_INDEX | Library::TITLE_INDEX);
+	MemoryUsage indexedUsage = weighed.memory_usage();
+	accounted = accounted && indexedUsage.indexes > 0 && indexedUsage.nodes == loadedUsage.nodes &&
+		indexedUsage.total() == loadedUsage.total() + indexedUsage.indexes && indexedUsage.shared == loadedUsage.shared;
+	/* The node pool keeps its blocks for the next inserts, the text stays with the library */
+	weighed.erase_range(0, ULONG_MAX);
+	MemoryUsage erasedUsage = weighed.memory_usage();
+	accounted = accounted && erasedUsage.elements == 0 && erasedUsage.nodes == 0 &&
+		erasedUsage.slack == loadedUsage.nodes + loadedUsage.slack && erasedUsage.shared == loadedUsage.shared;
+	weighed.set_indexes(0);
+	accounted = accounted && weighed.memory_usage().indexes == 0;
+	weighed = Library();
+	accounted = accounted && unused(weighed.memory_usage());
+	AVLTree<std::string> strings;
+	size_t owned = 0;
+	for (int i = 0; i < 100; i++) {
+		std::string s = std::string(40, 'a' + i % 26) + std::to_string(i);
+		strings.insert(s);
+		owned += HeapUsage<std::string>::bytes(*strings.lookup(s));
+	}
+	MemoryUsage stringUsage = strings.memory_usage();
+	accounted = accounted && stringUsage.elements == 100 && stringUsage.payload == owned && owned > 100 * 40 &&
+		stringUsage.nodes > 100 * sizeof(std::string) && stringUsage.shared == 0 &&
+		stringUsage.total() == stringUsage.nodes + stringUsage.payload + stringUsage.slack;
+	strings.clear();
+	if (!accounted || !unused(strings.memory_usage())) {
+		std::cerr << "FAILURE - XXV" << std::endl;
+		error++;
+	}
+
 	if (error == 0)
 		std::cout << "\t==> OK" << std::endl;
 	return error;
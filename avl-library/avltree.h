@@ -2,43 +2,239 @@
 #define __AVLTREE_H__
 
 #include <assert.h>
-#include "stack.h"
-
-template <class T>
-class AVLTree {
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "frozentree.h"
+#include "memoryusage.h"
+#include "nodepool.h"
+#include "prefetch.h"
+#include "threadpool.h"
+#include "treestats.h"
+
+template <class T, template <class> class Pool = NodePool, class Stats = DefaultStats>
+class AVLTree : private Stats {
 
 public:
 	AVLTree();
 	AVLTree(const AVLTree&);
+	AVLTree(AVLTree&&);
 	~AVLTree();
-	AVLTree<T>& operator = (const AVLTree<T>& other);
+	AVLTree<T, Pool, Stats>& operator = (const AVLTree<T, Pool, Stats>& other);
+	AVLTree<T, Pool, Stats>& operator = (AVLTree<T, Pool, Stats>&& other);
+	/*
+	 * Exchanges the content of two trees in O(1).
+	 */
+	void swap(AVLTree<T, Pool, Stats>& other);
 
 	bool isEmpty() const;
-	void clear();
 	bool contains(const T&) const;
 	void insert(const T&);
+	void insert(T&&);
+	/*
+	 * Inserts an element built in place in its node from the
+	 * arguments passed to a constructor of T. If an equal element
+	 * is already in the tree, the new one is move-assigned to it.
+	 */
+	template <class... Args>
+	void emplace(Args&&... args);
+	/*
+	 * Removes the element equal to the passed one, if any, in
+	 * O(log n). Nodes are relinked, never copied, so the other
+	 * elements keep their addresses.
+	 */
 	void remove(const T&);
+	/*
+	 * Same as remove, with a key of any type comparable with T (see
+	 * lookup), returning the removed element moved out of its node,
+	 * or nothing if the key is not in the tree.
+	 */
+	template <class K>
+	std::optional<T> extract(const K&);
+	/*
+	 * Bulk removals, both returning the number of elements removed.
+	 * The remaining nodes are relinked, never copied:
+	 * 		erase_range	removes the elements e such that low <= e <= high
+	 * 				with two splits and one join, in O(log n + k)
+	 * 				where k is the number of elements freed
+	 * 		retain_if	keeps only the elements for which keep(e) is
+	 * 				"true", in a single in-order pass, and links
+	 * 				them back perfectly balanced, in O(n)
+	 */
+	int erase_range(const T& low, const T& high);
+	template <class Predicate>
+	int retain_if(Predicate keep);
+
+	/*
+	 * Destroys every element. With a pool that owns its nodes and a
+	 * trivially destructible T, the whole tree is released in O(blocks)
+	 * instead of being walked node by node.
+	 */
+	void clear();
+	/*
+	 * Replaces the content of the tree with the elements of the range
+	 * [first, last). The range is sorted first if it is not already in
+	 * ascending order. Equal elements are merged in order of appearance
+	 * with the assignment operator of T, exactly as successive calls to
+	 * insert would do. On sorted input the tree is built perfectly
+	 * balanced in O(n), without any rotation.
+	 */
+	template <class ForwardIt>
+	void build(ForwardIt first, ForwardIt last);
+
+	/*
+	 * Order statistics, each in O(log n):
+	 * 		rank		number of elements strictly smaller than the key
+	 * 		select		k-th smallest element (from 0), NULL if k is out of range
+	 * 		count_range	number of elements e such that low <= e <= high
+	 */
+	int rank(const T&) const;
+	const T* select(int) const;
+	int count_range(const T&, const T&) const;
+
+	/*
+	 * Returns a pointer to the element equal to the key passed as
+	 * parameter, or NULL if there is none, in O(log n). The key may
+	 * be of any type K comparable with T through "key < element" and
+	 * "element < key", so no temporary T has to be built.
+	 */
+	template <class K>
+	const T* lookup(const K&) const;
+
+	/*
+	 * Batched lookups: results[i] receives the answer for keys[i].
+	 * The descents of up to BATCH_GROUP keys advance one level at a
+	 * time in lockstep, prefetching the next node of each one, so the
+	 * cache misses of independent lookups overlap.
+	 */
+	template <class K>
+	void find_batch(const K* keys, size_t count, const T** results) const;
+	template <class K>
+	void contains_batch(const K* keys, size_t count, bool* results) const;
+	static const size_t BATCH_GROUP = 16;
+
+	/*
+	 * Returns an immutable copy of the tree in a contiguous,
+	 * cache-friendly layout (see frozentree.h), in O(n).
+	 */
+	FrozenTree<T> freeze() const;
+
+	/*
+	 * Join-based primitives. Nodes are relinked between the trees,
+	 * never copied:
+	 * 		join		moves every element of "greater", which must all be
+	 * 				larger than those of the current tree, into the
+	 * 				current tree in O(log n)
+	 * 		split		moves the elements larger than the key into
+	 * 				"greater" (cleared first) in O(log n)
+	 * 		union_with	inserts every element of "other". When an element
+	 * 				is in both trees, combine(mine, theirs) is called
+	 * 				instead. Runs in O(m log(n/m + 1)), and merges
+	 * 				independent subtrees on a pool of "threads"
+	 * 				threads (0: one per core). A temporary tree is
+	 * 				emptied and its nodes relinked, any other tree
+	 * 				is copied first
+	 */
+	void join(AVLTree<T, Pool, Stats>& greater);
+	void split(const T&, AVLTree<T, Pool, Stats>& greater);
+	template <class Combine>
+	void union_with(const AVLTree<T, Pool, Stats>& other, Combine combine, unsigned threads = 0);
+	template <class Combine>
+	void union_with(AVLTree<T, Pool, Stats>&& other, Combine combine, unsigned threads = 0);
+
+	/*
+	 * Parallel traversals on "threads" threads (0: one per core). The
+	 * tree is cut into disjoint subtrees of about PARALLEL_CUTOFF
+	 * elements that are run by a work-stealing pool (see threadpool.h);
+	 * smaller trees are walked on the calling thread. The functions
+	 * passed are called concurrently and must not modify the tree:
+	 * 		parallel_for_each		f(e) for every element, in no
+	 * 						particular order
+	 * 		parallel_for_each_ordered	f(i, e) for every element, i
+	 * 						being its position in ascending
+	 * 						order (from 0), so results can be
+	 * 						stored in order
+	 * 		parallel_transform_reduce	reduce of init and transform(e)
+	 * 						for every element. "reduce" must
+	 * 						be associative and commutative
+	 * 		parallel_count_if		number of elements such that
+	 * 						pred(e)
+	 */
+	template <class F>
+	void parallel_for_each(F f, unsigned threads = 0) const;
+	template <class F>
+	void parallel_for_each_ordered(F f, unsigned threads = 0) const;
+	template <class R, class Transform, class Reduce>
+	R parallel_transform_reduce(R init, Transform transform, Reduce reduce, unsigned threads = 0) const;
+	template <class Predicate>
+	int parallel_count_if(Predicate pred, unsigned threads = 0) const;
 
 	/*
 	 * Returns "true" if the AVL trees have exactly the same
 	 * elements regardless of the order of appearance in both
 	 * trees. Otherwise, it returns "false".
 	 *
-	 *
-	 * This operator must be implemented in O(min(m,n)).				 *
-	 * Where n and m are the sizes of two AVL trees to compare. *
-	 *************************************************************
+	 * Both in-order sequences are walked together, so this runs in
+	 * O(min(m,n)) and stops at the first size or key mismatch.
+	 * Where n and m are the sizes of two AVL trees to compare.
 	 */
-	bool operator == (const AVLTree<T>& other) const;
+	bool operator == (const AVLTree<T, Pool, Stats>& other) const;
+
+	/*
+	 * Operation counters of the tree, as counted by the Stats policy
+	 * (see treestats.h). With the default NoStats policy nothing is
+	 * counted, the snapshot is all zeros and the tree pays nothing.
+	 */
+	TreeStats statistics() const;
+	void reset_statistics();
+	/*
+	 * Bytes used by the tree (see memoryusage.h). It takes O(number of
+	 * pool blocks), plus a walk of the tree when the elements own heap
+	 * memory. A tree sharing its pool with a copy reports all of it.
+	 */
+	MemoryUsage memory_usage() const;
 
 	/*
 	 * This iterator is based on an inorder traversal of the
-	 * current tree.
+	 * current tree. It is a standard bidirectional iterator over
+	 * constant elements that never allocates: the path from the
+	 * root is kept in a fixed array bounded by the AVL height.
+	 * begin() and end() make the tree usable with range-for and
+	 * <algorithm>. Modifying the tree invalidates all iterators.
 	 */
 	class Iterator;
+	typedef Iterator iterator;
+	typedef Iterator const_iterator;
 	Iterator begin() const;
+	Iterator end() const;
 	T& operator[] (const Iterator&);
 	const T& operator[] (const Iterator&) const;
+	/*
+	 * Positioning in O(log n), with a key of any type K comparable
+	 * with T (see lookup):
+	 * 		lower_bound	first element not smaller than the key
+	 * 		upper_bound	first element larger than the key
+	 * 		equal_range	both of them
+	 * 		range		view of the elements e such that
+	 * 				low <= e <= high
+	 * An iterator past the last element is equal to end(). Walking
+	 * from one bound to the other never searches the tree again.
+	 */
+	class Range;
+	template <class K>
+	Iterator lower_bound(const K&) const;
+	template <class K>
+	Iterator upper_bound(const K&) const;
+	template <class K>
+	std::pair<Iterator, Iterator> equal_range(const K&) const;
+	template <class K>
+	Range range(const K& low, const K& high) const;
 
 	/*
 	 * These functions are implemented for testing and diagnostic purposes.
@@ -53,33 +249,105 @@ public:
 
 private:
 	struct Node {
-		Node(const T&);
+		template <class... Args>
+		Node(Args&&... args);
 		T content;
 		int balance;
+		int height;
+		int nodes;
 		Node* left;
 		Node* right;
 	};
 	Node* root;
-	
+	Pool<Node> pool;
+	typedef typename Stats::Scope Scope;
+	/*
+	 * The policy is a private base, so that NoStats takes no space.
+	 */
+	const Stats& stats() const;
+	/*
+	 * Comparisons of the searches, counted by the Stats policy.
+	 */
+	template <class A, class B>
+	bool less(const A&, const B&) const;
+	template <class A, class B>
+	bool greater(const A&, const B&) const;
+
 	bool sameNode(Node*, Node*);
-	Node* remove(Node*&, const T&);
-	Node* insert(Node*&, const T&);
+	template <class K>
+	Node* detach(Node*&, const K&);
+	template <class U>
+	Node* insert(Node*&, U&&);
+	Node* insertNode(Node*&, Node*);
 	Node* balance(Node*&);
 	bool compare(Node*) const;
 	void clear(Node*&);
 	const T* searchElem(Node*, const T&) const;
 	Node* copy(Node* node);
+	template <class... Args>
+	Node* createNode(Args&&...);
+	void destroyNode(Node*);
+	Node* build(T*, int, int);
+	Node* link(Node**, int, int);
+	template <class Predicate>
+	void filter(Node*, Predicate&, std::vector<Node*>&);
 	Node* singleLeftRotation(Node*&);
 	Node* singleRightRotation(Node*&);
 	Node* doubleLeftRotation(Node*&);
 	Node* doubleRightRotation(Node*&);
 	int size(Node*) const;
+	int weight(Node*) const;
+	void update(Node*);
 	int getBalance(Node*&);
-	Node* minNode(Node*&);
+	template <class K>
+	void findGroup(const K*, size_t, const T**) const;
+	Node* extractMin(Node*&);
+	Node* join(Node*, Node*, Node*);
+	Node* join(Node*, Node*);
+	Node* joinRight(Node*, Node*, Node*);
+	Node* joinLeft(Node*, Node*, Node*);
+	void split(Node*, const T&, Node*&, Node*&, Node*&);
+	template <class Combine>
+	Node* unite(Node*, Node*, Combine&, std::vector<Node*>&);
+	/*
+	 * Parallel union of the current tree with nodes it already owns.
+	 * The large nodes of "theirs" are split on the calling thread into
+	 * Pieces: the pairs of subtrees below them are merged by tasks of
+	 * the pool, then the large nodes are joined back over the results.
+	 */
+	struct Piece {
+		Node* mine;
+		Node* theirs;
+		Node* found;
+		size_t left;
+		size_t right;
+		std::vector<Node*> discarded;
+	};
+	template <class Combine>
+	void absorb(Node*, Combine&, unsigned threads);
+	size_t divide(Node*, Node*, std::vector<Piece>&);
+	template <class Combine>
+	Node* conquer(size_t, std::vector<Piece>&, Combine&);
+	/*
+	 * Pool running a parallel traversal, NULL when the tree is walked
+	 * on the calling thread. traverse calls visit(e, i, worker) on
+	 * every element e at position i, "worker" being the index of the
+	 * thread (0 without a pool). walk visits a subtree, submitting
+	 * the right subtrees of its large nodes to the pool.
+	 */
+	std::unique_ptr<ThreadPool> workers(unsigned threads) const;
+	template <class Visit>
+	void traverse(Visit&, ThreadPool*) const;
+	template <class Visit>
+	void walk(Node*, int, Visit&, ThreadPool*, unsigned) const;
+	/*
+	 * Subtrees smaller than this are never walked or merged by a task
+	 * of their own.
+	 */
+	static const int PARALLEL_CUTOFF = 1 << 14;
 	Iterator searchEqualOrPrevious(const T&) const;
 	Iterator searchEqualOrNext(const T&) const;
 	Iterator search(const T&) const;
-	Iterator end() const;
 	/*
 	 * These functions are implemented for testing purposes.
 	 */
@@ -91,202 +359,1008 @@ private:
 public:
 	class Iterator {
 	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		Iterator();
 		Iterator(const Iterator&);
 		Iterator(const AVLTree&);
+		Iterator& operator = (const Iterator&);
 		operator bool() const;
+		reference operator*() const;
+		pointer operator->() const;
 		Iterator operator++(int);
 		Iterator& operator++();
+		Iterator operator--(int);
+		Iterator& operator--();
+		bool operator == (const Iterator&) const;
+		bool operator != (const Iterator&) const;
 
 	private:
+		/*
+		 * An AVL tree of 2^31 elements is at most 45 levels high.
+		 */
+		static const int MAX_DEPTH = 64;
+
+		void push(Node*);
 		Node* current;
-		const AVLTree& associated_tree;
-		Stack<Node*> path;
+		const AVLTree* associated_tree;
+		Node* path[MAX_DEPTH];
+		int depth;
 		friend class AVLTree;
 	};
+
+	/*
+	 * A pair of iterators usable with range-for.
+	 */
+	class Range {
+	public:
+		Range(const Iterator& first, const Iterator& last);
+		Iterator begin() const;
+		Iterator end() const;
+		bool empty() const;
+
+	private:
+		Iterator first;
+		Iterator last;
+	};
 };
 
 /************ Public Functions ***************/
 
-template <class T>
-AVLTree<T>::Node::Node(const T& c) : content(c), balance(0), left(nullptr), right(nullptr) {
+template <class T, template <class> class Pool, class Stats>
+template <class... Args>
+AVLTree<T, Pool, Stats>::Node::Node(Args&&... args) : content(std::forward<Args>(args)...), balance(0), height(1), nodes(1), left(nullptr), right(nullptr) {
 }
 
-template <class T>
-AVLTree<T>::AVLTree() : root(nullptr) {
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::AVLTree() : root(nullptr) {
 }
 
-template <class T>
-AVLTree<T>::AVLTree(const AVLTree<T>& other) : root(nullptr) {
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::AVLTree(const AVLTree<T, Pool, Stats>& other) : Stats(), root(nullptr) {
 	this->operator =(other);
 }
 
-template <class T>
-AVLTree<T>::~AVLTree() {
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::AVLTree(AVLTree<T, Pool, Stats>&& other) : Stats(), root(nullptr) {
+	swap(other);
+}
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::~AVLTree() {
 	clear();
 }
 
-template <class T>
-bool AVLTree<T>::isEmpty() const {
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::isEmpty() const {
 	return root == nullptr;
 }
 
-template <class T>
-void AVLTree<T>::clear() {
-	clear(root);
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::clear() {
+	Scope scope(stats(), OP_BULK);
+	if (Pool<Node>::owns_nodes && std::is_trivially_destructible<T>::value) {
+		stats().free(weight(root));
+		root = nullptr;
+	}
+	else
+		clear(root);
+	pool.release();
 }
 
-template <class T>
-bool AVLTree<T>::contains(const T& element) const {
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::contains(const T& element) const {
+	Scope scope(stats(), OP_LOOKUP);
 	if (searchElem(root, element) == nullptr)
 		return false;
 	else
 		return true;
 }
 
-template <class T>
-void AVLTree<T>::insert(const T& e) {
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::insert(const T& e) {
+	Scope scope(stats(), OP_INSERT);
 	insert(root, e);
 }
 
-template <class T>
-void AVLTree<T>::remove(const T& e) {
-	remove(root, e);
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::insert(T&& e) {
+	Scope scope(stats(), OP_INSERT);
+	insert(root, std::move(e));
 }
 
-template <class T>
-AVLTree<T>& AVLTree<T>::operator = (const AVLTree& other) {
+template <class T, template <class> class Pool, class Stats>
+template <class... Args>
+void AVLTree<T, Pool, Stats>::emplace(Args&&... args) {
+	Scope scope(stats(), OP_INSERT);
+	insertNode(root, createNode(std::forward<Args>(args)...));
+}
+
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::remove(const T& e) {
+	Scope scope(stats(), OP_REMOVE);
+	Node* removed = detach(root, e);
+	if (removed != nullptr)
+		destroyNode(removed);
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+std::optional<T> AVLTree<T, Pool, Stats>::extract(const K& key) {
+	Scope scope(stats(), OP_REMOVE);
+	Node* removed = detach(root, key);
+	if (removed == nullptr)
+		return std::nullopt;
+	std::optional<T> element(std::move(removed->content));
+	destroyNode(removed);
+	return element;
+}
+
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::erase_range(const T& low, const T& high) {
+	if (high < low)
+		return 0;
+	Scope scope(stats(), OP_REMOVE);
+	Node* left;
+	Node* first;
+	Node* rest;
+	Node* middle;
+	Node* last;
+	Node* right;
+	split(root, low, left, first, rest);
+	split(rest, high, middle, last, right);
+	int erased = weight(middle);
+	clear(middle);
+	if (first != nullptr) {
+		destroyNode(first);
+		erased++;
+	}
+	if (last != nullptr) {
+		destroyNode(last);
+		erased++;
+	}
+	root = join(left, right);
+	return erased;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class Predicate>
+int AVLTree<T, Pool, Stats>::retain_if(Predicate keep) {
+	Scope scope(stats(), OP_REMOVE);
+	int before = weight(root);
+	std::vector<Node*> kept;
+	kept.reserve(before);
+	filter(root, keep, kept);
+	root = link(kept.data(), 0, (int)kept.size() - 1);
+	return before - (int)kept.size();
+}
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>& AVLTree<T, Pool, Stats>::operator = (const AVLTree& other) {
 	if (this == &other) {
 		return *this;
 	}
+	Scope scope(stats(), OP_BULK);
 	clear();
 	root = copy(other.root);
 	return *this;
 }
 
-template <class T>
-bool AVLTree<T>::operator == (const AVLTree<T>& other) const {
-	int found;
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>& AVLTree<T, Pool, Stats>::operator = (AVLTree&& other) {
+	if (this == &other) {
+		return *this;
+	}
+	clear();
+	swap(other);
+	return *this;
+}
+
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::swap(AVLTree<T, Pool, Stats>& other) {
+	std::swap(root, other.root);
+	pool.swap(other.pool);
+}
+
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::operator == (const AVLTree<T, Pool, Stats>& other) const {
+	if (this == &other)
+		return true;
+	if (weight(root) != weight(other.root))
+		return false;
+	Scope scope(stats(), OP_ITERATE);
 	Iterator iter1 = begin();
-	while (!iter1.path.empty()) {
-		found = 0;
-		T content1 = this->operator[](iter1);
-		for (Iterator iter2 = other.begin(); iter2; ++iter2) {
-			T content2 = this->operator[](iter2);
-			if (content1 == content2)
-				found = +1;
-		}
-		if (found == 0) {
+	Iterator iter2 = other.begin();
+	while (iter1 && iter2) {
+		if (iter1.current->content != iter2.current->content)
 			return false;
-		}
 		++iter1;
+		++iter2;
 	}
-	return true;
+	return !iter1 && !iter2;
 }
 
-template <class T>
-typename AVLTree<T>::Iterator AVLTree<T>::begin() const {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::begin() const {
+	Scope scope(stats(), OP_ITERATE);
 	Iterator iter(*this);
 	iter.current = root;
 	if (iter.current != nullptr) {
+		stats().visit();
 		while (iter.current->left != nullptr) {
-			iter.path.push(iter.current);
+			stats().visit();
+			iter.push(iter.current);
 			iter.current = iter.current->left;
 		}
 	}
 	return iter;
 }
 
-template <class T>
-T& AVLTree<T>::operator[](const Iterator& i) {
-	Iterator found = searchEqualOrPrevious(i.current->content);
-	return found.current->content;
+template <class T, template <class> class Pool, class Stats>
+T& AVLTree<T, Pool, Stats>::operator[](const Iterator& i) {
+	assert(i.current);
+	return i.current->content;
+}
+
+template <class T, template <class> class Pool, class Stats>
+const T& AVLTree<T, Pool, Stats>::operator[](const Iterator& i) const {
+	assert(i.current);
+	return i.current->content;
 }
 
-template <class T>
-const T& AVLTree<T>::operator[](const Iterator& i) const {
-	Iterator found = searchEqualOrPrevious(i.current->content);
-	return found.current->content;
+template <class T, template <class> class Pool, class Stats>
+template <class ForwardIt>
+void AVLTree<T, Pool, Stats>::build(ForwardIt first, ForwardIt last) {
+	Scope scope(stats(), OP_BULK);
+	std::vector<T> merged;
+	if (std::is_sorted(first, last)) {
+		for (; first != last; ++first) {
+			if (!merged.empty() && merged.back() == *first)
+				merged.back() = *first;
+			else
+				merged.push_back(*first);
+		}
+	}
+	else {
+		std::vector<T> items(first, last);
+		std::vector<T*> order;
+		order.reserve(items.size());
+		for (T& e : items)
+			order.push_back(&e);
+		std::stable_sort(order.begin(), order.end(),
+			[](const T* a, const T* b) { return *a < *b; });
+		for (T* e : order) {
+			if (!merged.empty() && merged.back() == *e)
+				merged.back() = std::move(*e);
+			else
+				merged.push_back(std::move(*e));
+		}
+	}
+	clear();
+	root = build(merged.data(), 0, (int)merged.size() - 1);
+}
+
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::rank(const T& e) const {
+	Scope scope(stats(), OP_LOOKUP);
+	int smaller = 0;
+	Node* n = root;
+	while (n) {
+		stats().visit();
+		if (less(n->content, e)) {
+			smaller += weight(n->left) + 1;
+			n = n->right;
+		}
+		else {
+			n = n->left;
+		}
+	}
+	return smaller;
+}
+
+template <class T, template <class> class Pool, class Stats>
+const T* AVLTree<T, Pool, Stats>::select(int k) const {
+	if (k < 0 || k >= weight(root))
+		return nullptr;
+	Scope scope(stats(), OP_LOOKUP);
+	Node* n = root;
+	while (n) {
+		stats().visit();
+		int left = weight(n->left);
+		if (k < left) {
+			n = n->left;
+		}
+		else if (k > left) {
+			k -= left + 1;
+			n = n->right;
+		}
+		else {
+			return &(n->content);
+		}
+	}
+	return nullptr;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+const T* AVLTree<T, Pool, Stats>::lookup(const K& key) const {
+	Scope scope(stats(), OP_LOOKUP);
+	Node* n = root;
+	while (n) {
+		stats().visit();
+		if (less(key, n->content))
+			n = n->left;
+		else if (less(n->content, key))
+			n = n->right;
+		else
+			return &(n->content);
+	}
+	return nullptr;
+}
+
+/*
+ * Descends from the root, recording the path in the iterator. Every node
+ * not smaller than the key is a candidate; the last one met is the
+ * answer, and the nodes pushed above it are exactly its ancestors.
+ */
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::lower_bound(const K& key) const {
+	Scope scope(stats(), OP_LOOKUP);
+	Iterator iter(*this);
+	Node* candidate = nullptr;
+	int depth = 0;
+	Node* n = root;
+	while (n) {
+		stats().visit();
+		if (less(n->content, key)) {
+			iter.push(n);
+			n = n->right;
+		}
+		else {
+			candidate = n;
+			depth = iter.depth;
+			iter.push(n);
+			n = n->left;
+		}
+	}
+	iter.current = candidate;
+	iter.depth = candidate != nullptr ? depth : 0;
+	return iter;
+}
+
+/*
+ * Same descent as lower_bound, keeping the last node larger than the key.
+ */
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::upper_bound(const K& key) const {
+	Scope scope(stats(), OP_LOOKUP);
+	Iterator iter(*this);
+	Node* candidate = nullptr;
+	int depth = 0;
+	Node* n = root;
+	while (n) {
+		stats().visit();
+		if (less(key, n->content)) {
+			candidate = n;
+			depth = iter.depth;
+			iter.push(n);
+			n = n->left;
+		}
+		else {
+			iter.push(n);
+			n = n->right;
+		}
+	}
+	iter.current = candidate;
+	iter.depth = candidate != nullptr ? depth : 0;
+	return iter;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+std::pair<typename AVLTree<T, Pool, Stats>::Iterator, typename AVLTree<T, Pool, Stats>::Iterator> AVLTree<T, Pool, Stats>::equal_range(const K& key) const {
+	return std::make_pair(lower_bound(key), upper_bound(key));
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+typename AVLTree<T, Pool, Stats>::Range AVLTree<T, Pool, Stats>::range(const K& low, const K& high) const {
+	if (high < low)
+		return Range(end(), end());
+	return Range(lower_bound(low), upper_bound(high));
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+void AVLTree<T, Pool, Stats>::find_batch(const K* keys, size_t count, const T** results) const {
+	Scope scope(stats(), OP_LOOKUP);
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		findGroup(keys + first, group, results + first);
+	}
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+void AVLTree<T, Pool, Stats>::contains_batch(const K* keys, size_t count, bool* results) const {
+	Scope scope(stats(), OP_LOOKUP);
+	const T* found[BATCH_GROUP];
+	for (size_t first = 0; first < count; first += BATCH_GROUP) {
+		size_t group = count - first < BATCH_GROUP ? count - first : BATCH_GROUP;
+		findGroup(keys + first, group, found);
+		for (size_t i = 0; i < group; i++)
+			results[first + i] = found[i] != nullptr;
+	}
+}
+
+template <class T, template <class> class Pool, class Stats>
+FrozenTree<T> AVLTree<T, Pool, Stats>::freeze() const {
+	Scope scope(stats(), OP_ITERATE);
+	return FrozenTree<T>(begin(), end());
+}
+
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::count_range(const T& low, const T& high) const {
+	if (high < low)
+		return 0;
+	Scope scope(stats(), OP_LOOKUP);
+	return rank(high) - rank(low) + (contains(high) ? 1 : 0);
+}
+
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::join(AVLTree<T, Pool, Stats>& greater) {
+	if (this == &greater || greater.root == nullptr)
+		return;
+	Scope scope(stats(), OP_BULK);
+	pool.share(greater.pool);
+	assert(root == nullptr || *(--end()) < *greater.begin());
+	root = join(root, greater.root);
+	greater.root = nullptr;
+	greater.pool.release();
+}
+
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::split(const T& key, AVLTree<T, Pool, Stats>& greater) {
+	if (this == &greater)
+		return;
+	Scope scope(stats(), OP_BULK);
+	greater.clear();
+	Node* left;
+	Node* found;
+	Node* right;
+	split(root, key, left, found, right);
+	if (found != nullptr)
+		left = join(left, found, nullptr);
+	root = left;
+	greater.root = right;
+	if (right != nullptr)
+		greater.pool.share(pool);
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class Combine>
+void AVLTree<T, Pool, Stats>::union_with(const AVLTree<T, Pool, Stats>& other, Combine combine, unsigned threads) {
+	Scope scope(stats(), OP_BULK);
+	absorb(copy(other.root), combine, threads);
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class Combine>
+void AVLTree<T, Pool, Stats>::union_with(AVLTree<T, Pool, Stats>&& other, Combine combine, unsigned threads) {
+	if (this == &other)
+		return;
+	Scope scope(stats(), OP_BULK);
+	pool.share(other.pool);
+	Node* theirs = other.root;
+	other.root = nullptr;
+	other.pool.release();
+	absorb(theirs, combine, threads);
+}
+
+template <class T, template <class> class Pool, class Stats>
+TreeStats AVLTree<T, Pool, Stats>::statistics() const {
+	return stats().snapshot();
+}
+
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::reset_statistics() {
+	Stats::reset();
+}
+
+template <class T, template <class> class Pool, class Stats>
+MemoryUsage AVLTree<T, Pool, Stats>::memory_usage() const {
+	MemoryUsage usage = MemoryUsage();
+	usage.elements = weight(root);
+	usage.nodes = usage.elements * sizeof(Node);
+	if (HeapUsage<T>::owns_heap) {
+		for (const T& value : *this)
+			usage.payload += HeapUsage<T>::bytes(value);
+	}
+	size_t reserved = Pool<Node>::owns_nodes ? pool.reserved() : usage.nodes;
+	usage.slack = reserved > usage.nodes ? reserved - usage.nodes : 0;
+	usage.iterator = sizeof(Iterator);
+	return usage;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class F>
+void AVLTree<T, Pool, Stats>::parallel_for_each(F f, unsigned threads) const {
+	Scope scope(stats(), OP_ITERATE);
+	std::unique_ptr<ThreadPool> pool = workers(threads);
+	auto visit = [&](const T& e, int, unsigned) { f(e); };
+	traverse(visit, pool.get());
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class F>
+void AVLTree<T, Pool, Stats>::parallel_for_each_ordered(F f, unsigned threads) const {
+	Scope scope(stats(), OP_ITERATE);
+	std::unique_ptr<ThreadPool> pool = workers(threads);
+	auto visit = [&](const T& e, int i, unsigned) { f(i, e); };
+	traverse(visit, pool.get());
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class R, class Transform, class Reduce>
+R AVLTree<T, Pool, Stats>::parallel_transform_reduce(R init, Transform transform, Reduce reduce, unsigned threads) const {
+	Scope scope(stats(), OP_ITERATE);
+	/* One partial result per worker, each on its own cache line */
+	struct alignas(64) Partial {
+		std::optional<R> value;
+	};
+	std::unique_ptr<ThreadPool> pool = workers(threads);
+	std::vector<Partial> partials(pool != nullptr ? pool->size() : 1);
+	auto visit = [&](const T& e, int, unsigned worker) {
+		std::optional<R>& partial = partials[worker].value;
+		if (partial)
+			*partial = reduce(std::move(*partial), transform(e));
+		else
+			partial.emplace(transform(e));
+	};
+	traverse(visit, pool.get());
+	for (Partial& p : partials) {
+		if (p.value)
+			init = reduce(std::move(init), std::move(*p.value));
+	}
+	return init;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class Predicate>
+int AVLTree<T, Pool, Stats>::parallel_count_if(Predicate pred, unsigned threads) const {
+	return parallel_transform_reduce(0, [&](const T& e) { return pred(e) ? 1 : 0; },
+		[](int a, int b) { return a + b; }, threads);
 }
 
 /************ Private Functions ***************/
 
+template <class T, template <class> class Pool, class Stats>
+const Stats& AVLTree<T, Pool, Stats>::stats() const
+{
+	return *this;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class A, class B>
+bool AVLTree<T, Pool, Stats>::less(const A& a, const B& b) const
+{
+	stats().compare();
+	return a < b;
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class A, class B>
+bool AVLTree<T, Pool, Stats>::greater(const A& a, const B& b) const
+{
+	stats().compare();
+	return a > b;
+}
+
 /*
 
-Returns a pointer to the new root node after removing the node
-containing the object of type T passed in parameters
+Unlinks the node equal to the key from the subtree passed as parameter and
+returns it, with no children, or NULL if there is none. Nodes are only
+relinked: the successor of a node with two children takes its place, and
+no element is copied or moved. Only the path down to the node is rebalanced.
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::remove(Node*& node, const T& e)
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::detach(Node*& node, const K& key)
 {
-	/* Traverse the tree using recursion and find the node
-	whose content is equal to the object e passed in parameter*/
 	if (node == nullptr)
-		return node;
-	if (e < node->content)
-	{
-		node->left = remove(node->left, e);
+		return nullptr;
+	stats().visit();
+	Node* removed;
+	if (less(key, node->content)) {
+		removed = detach(node->left, key);
 	}
-	else if (e > node->content)
-	{
-		node->right = remove(node->right, e);
-
+	else if (less(node->content, key)) {
+		removed = detach(node->right, key);
 	}
-	/* Once found, disconnect the node from the tree and remove it
-	while keeping the child nodes */
-	else
-	{
-		if (node->left == nullptr || node->right == nullptr)
-		{
-			Node* temp = node->left ? node->left : node->right;
-			if (temp == nullptr) {
-				temp = node;
-				node = nullptr;
-			}
-			else {
-				*node = *temp;
-			}
-			delete temp;
+	else {
+		removed = node;
+		if (node->left == nullptr) {
+			node = node->right;
 		}
-		else
-		{
-			Node* temp = minNode(node->right);
+		else if (node->right == nullptr) {
+			node = node->left;
+		}
+		else {
+			Node* successor = extractMin(node->right);
+			successor->left = node->left;
+			successor->right = node->right;
+			node = successor;
+		}
+		removed->left = nullptr;
+		removed->right = nullptr;
+		if (node == nullptr)
+			return removed;
+	}
+	if (removed != nullptr)
+		node = balance(node);
+	return removed;
+}
 
+/*
 
-			node->content = temp->content;
+Detaches the node with the smallest value from the subtree passed as
+parameter, rebalancing it, and returns that node with no children.
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::extractMin(Node*& node)
+{
+	stats().visit();
+	if (node->left == nullptr) {
+		Node* min = node;
+		node = node->right;
+		min->right = nullptr;
+		update(min);
+		return min;
+	}
+	Node* min = extractMin(node->left);
+	node = balance(node);
+	return min;
+}
+
+/*
+
+Returns the root of a balanced tree holding the nodes of "left", then the
+node "middle", then the nodes of "right", in that order. Every element of
+"left" must be smaller than "middle" and every element of "right" larger.
+Runs in O(|height(left) - height(right)| + 1).
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::join(Node* left, Node* middle, Node* right)
+{
+	if (size(left) > size(right) + 1)
+		return joinRight(left, middle, right);
+	if (size(right) > size(left) + 1)
+		return joinLeft(left, middle, right);
+	middle->left = left;
+	middle->right = right;
+	update(middle);
+	return middle;
+}
+
+/*
+
+Join helper when "left" is the taller tree: walks down its right spine
+until the heights match, links there and rebalances on the way back up.
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::joinRight(Node* left, Node* middle, Node* right)
+{
+	stats().visit();
+	if (size(left) <= size(right) + 1) {
+		middle->left = left;
+		middle->right = right;
+		update(middle);
+		return middle;
+	}
+	left->right = joinRight(left->right, middle, right);
+	return balance(left);
+}
+
+/*
+
+Same as join without a middle node: the smallest node of "right" is
+detached to take its place. Runs in O(log n).
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::join(Node* left, Node* right)
+{
+	if (right == nullptr)
+		return left;
+	Node* middle = extractMin(right);
+	return join(left, middle, right);
+}
+
+/*
+
+Join helper when "right" is the taller tree, symmetric to joinRight.
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::joinLeft(Node* left, Node* middle, Node* right)
+{
+	stats().visit();
+	if (size(right) <= size(left) + 1) {
+		middle->left = left;
+		middle->right = right;
+		update(middle);
+		return middle;
+	}
+	right->left = joinLeft(left, middle, right->left);
+	return balance(right);
+}
+
+/*
+
+Splits the subtree passed as parameter around the key: "left" receives the
+nodes smaller than the key, "right" the larger ones and "found" the node
+equal to the key (detached), or NULL. Runs in O(log n).
+*/
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::split(Node* node, const T& key, Node*& left, Node*& found, Node*& right)
+{
+	if (node == nullptr) {
+		left = nullptr;
+		found = nullptr;
+		right = nullptr;
+		return;
+	}
+	stats().visit();
+	if (less(key, node->content)) {
+		Node* middle;
+		split(node->left, key, left, found, middle);
+		right = join(middle, node, node->right);
+	}
+	else if (less(node->content, key)) {
+		Node* middle;
+		split(node->right, key, middle, found, right);
+		left = join(node->left, node, middle);
+	}
+	else {
+		left = node->left;
+		right = node->right;
+		node->left = nullptr;
+		node->right = nullptr;
+		update(node);
+		found = node;
+	}
+}
+
+/*
+
+Returns the root of the union of two subtrees owned by the current tree.
+The first subtree is split around the root of the second one, both halves
+are merged recursively and the results are joined back. When a key is in
+both subtrees, the node of the second one is combined into the node of
+the first one and recorded in "discarded", to be freed by the caller.
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class Combine>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::unite(Node* mine, Node* theirs, Combine& combine, std::vector<Node*>& discarded)
+{
+	if (theirs == nullptr)
+		return mine;
+	if (mine == nullptr)
+		return theirs;
+	Node* theirsLeft = theirs->left;
+	Node* theirsRight = theirs->right;
+	Node* mineLeft;
+	Node* found;
+	Node* mineRight;
+	split(mine, theirs->content, mineLeft, found, mineRight);
+	Node* left = unite(mineLeft, theirsLeft, combine, discarded);
+	Node* right = unite(mineRight, theirsRight, combine, discarded);
+	if (found != nullptr) {
+		combine(found->content, theirs->content);
+		theirs->left = nullptr;
+		theirs->right = nullptr;
+		discarded.push_back(theirs);
+		return join(left, found, right);
+	}
+	return join(left, theirs, right);
+}
+
+/*
 
-			node->right = remove(node->right,
-				temp->content);
+Merges the subtree "theirs" into the tree. Below PARALLEL_CUTOFF elements
+(or with one thread) this is a plain unite; otherwise the pieces are
+merged by a pool, which is only waited for from the calling thread.
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class Combine>
+void AVLTree<T, Pool, Stats>::absorb(Node* theirs, Combine& combine, unsigned threads)
+{
+	std::vector<Node*> discarded;
+	if (threads == 1 || root == nullptr || weight(theirs) < PARALLEL_CUTOFF) {
+		root = unite(root, theirs, combine, discarded);
+	}
+	else {
+		std::vector<Piece> pieces;
+		divide(root, theirs, pieces);
+		ThreadPool workers(threads);
+		for (size_t i = 0; i < pieces.size(); i++) {
+			Piece* piece = &pieces[i];
+			if (piece->left == 0)
+				workers.submit([this, piece, &combine]() {
+					piece->mine = unite(piece->mine, piece->theirs, combine, piece->discarded);
+				});
 		}
+		workers.wait();
+		root = conquer(0, pieces, combine);
+		for (size_t i = 0; i < pieces.size(); i++)
+			discarded.insert(discarded.end(), pieces[i].discarded.begin(), pieces[i].discarded.end());
 	}
+	for (size_t i = 0; i < discarded.size(); i++)
+		destroyNode(discarded[i]);
+}
 
-	if (node == nullptr) return node;
-	/* Call the balance method to balance the node */
-	node = balance(node);
+/*
 
-	return node;
+Records the union of "mine" and "theirs" as the piece returned (its
+index). While "theirs" has at least PARALLEL_CUTOFF elements, "mine" is
+split around its root, which is kept in the piece with the matching node
+of "mine" ("found"), and both halves become pieces of their own. Every
+other piece is a leaf (left == 0, as the first piece is never a child),
+left to a task. The subtrees of "theirs" are read before they are handed
+out, so that the tasks are the only ones to touch them.
+*/
+template <class T, template <class> class Pool, class Stats>
+size_t AVLTree<T, Pool, Stats>::divide(Node* mine, Node* theirs, std::vector<Piece>& pieces)
+{
+	size_t index = pieces.size();
+	pieces.push_back(Piece());
+	pieces[index].mine = mine;
+	pieces[index].theirs = theirs;
+	pieces[index].found = nullptr;
+	pieces[index].left = 0;
+	pieces[index].right = 0;
+	if (mine == nullptr || weight(theirs) < PARALLEL_CUTOFF)
+		return index;
+	Node* mineLeft;
+	Node* found;
+	Node* mineRight;
+	split(mine, theirs->content, mineLeft, found, mineRight);
+	Node* theirsLeft = theirs->left;
+	Node* theirsRight = theirs->right;
+	pieces[index].found = found;
+	size_t left = divide(mineLeft, theirsLeft, pieces);
+	size_t right = divide(mineRight, theirsRight, pieces);
+	pieces[index].left = left;
+	pieces[index].right = right;
+	return index;
 }
 
 /*
 
-Returns a pointer to the node with the smallest value (content)
+Returns the root of the piece passed, once its tasks are done: a leaf
+holds the result of its task, a large node is combined or joined back
+over its halves as unite does.
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::minNode(Node*& node)
+template <class T, template <class> class Pool, class Stats>
+template <class Combine>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::conquer(size_t index, std::vector<Piece>& pieces, Combine& combine)
 {
-	Node* current = node;
-	/* Traverse downwards to find the leftmost leaf */
-	while (current->left != nullptr)
-		current = current->left;
+	Piece& piece = pieces[index];
+	if (piece.left == 0)
+		return piece.mine;
+	Node* left = conquer(piece.left, pieces, combine);
+	Node* right = conquer(piece.right, pieces, combine);
+	Node* theirs = piece.theirs;
+	if (piece.found != nullptr) {
+		combine(piece.found->content, theirs->content);
+		theirs->left = nullptr;
+		theirs->right = nullptr;
+		piece.discarded.push_back(theirs);
+		return join(left, piece.found, right);
+	}
+	return join(left, theirs, right);
+}
+
+template <class T, template <class> class Pool, class Stats>
+std::unique_ptr<ThreadPool> AVLTree<T, Pool, Stats>::workers(unsigned threads) const {
+	if (threads == 1 || weight(root) < PARALLEL_CUTOFF)
+		return nullptr;
+	return std::unique_ptr<ThreadPool>(new ThreadPool(threads));
+}
+
+template <class T, template <class> class Pool, class Stats>
+template <class Visit>
+void AVLTree<T, Pool, Stats>::traverse(Visit& visit, ThreadPool* pool) const {
+	if (pool == nullptr) {
+		walk(root, 0, visit, nullptr, 0);
+		return;
+	}
+	pool->submit([this, &visit, pool]() {
+		walk(root, 0, visit, pool, pool->worker());
+	});
+	pool->wait();
+}
+
+/*
+
+Visits the subtree rooted at "node" in order, "first" being the position
+of its smallest element. The right subtree of a node of at least
+PARALLEL_CUTOFF elements is submitted to the pool instead, so it lands on
+the queue of the current worker, where idle workers can steal it.
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class Visit>
+void AVLTree<T, Pool, Stats>::walk(Node* node, int first, Visit& visit, ThreadPool* pool, unsigned worker) const
+{
+	if (node == nullptr)
+		return;
+	stats().visit();
+	int position = first + weight(node->left);
+	if (pool != nullptr && weight(node) >= PARALLEL_CUTOFF) {
+		Node* right = node->right;
+		pool->submit([this, right, position, &visit, pool]() {
+			walk(right, position + 1, visit, pool, pool->worker());
+		});
+		walk(node->left, first, visit, pool, worker);
+		visit(const_cast<const T&>(node->content), position, worker);
+		return;
+	}
+	walk(node->left, first, visit, pool, worker);
+	visit(const_cast<const T&>(node->content), position, worker);
+	walk(node->right, position + 1, visit, pool, worker);
+}
+
+/*
 
-	return current;
+Looks up at most BATCH_GROUP keys at once: each round moves every
+unfinished descent one level down and prefetches the node it reaches,
+which is only read in the next round.
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class K>
+void AVLTree<T, Pool, Stats>::findGroup(const K* keys, size_t group, const T** results) const
+{
+	Node* current[BATCH_GROUP];
+	for (size_t i = 0; i < group; i++) {
+		current[i] = root;
+		results[i] = nullptr;
+	}
+	size_t active = root != nullptr ? group : 0;
+	while (active > 0) {
+		for (size_t i = 0; i < group; i++) {
+			Node* n = current[i];
+			if (n == nullptr)
+				continue;
+			stats().visit();
+			if (less(keys[i], n->content)) {
+				n = n->left;
+			}
+			else if (less(n->content, keys[i])) {
+				n = n->right;
+			}
+			else {
+				results[i] = &(n->content);
+				n = nullptr;
+			}
+			if (n != nullptr)
+				AVL_PREFETCH(n);
+			else
+				active--;
+			current[i] = n;
+		}
+	}
 }
 
 /*
 
 Returns true if the two trees are equal
 */
-template <class T>
-bool AVLTree<T>::compare(Node* node) const
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::compare(Node* node) const
 {
 	if (node) {
 		if (!compare(node->left)) {
@@ -305,8 +1379,8 @@ bool AVLTree<T>::compare(Node* node) const
  * Returns true if the two nodes passed as parameters are equal
  *
 */
-template <class T>
-bool AVLTree<T>::sameNode(Node* node1, Node* node2)
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::sameNode(Node* node1, Node* node2)
 {
 	if (!node1 && !node2)
 		return true;
@@ -327,23 +1401,49 @@ bool AVLTree<T>::sameNode(Node* node1, Node* node2)
  * Returns the balance factor of the node passed as parameter
  *
 */
-template <class T>
-int AVLTree<T>::getBalance(Node*& node) {
-	return (size(node->left) - size(node->right));
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::getBalance(Node*& node) {
+	return node->balance;
 }
 
 
 /*
- * Returns the size of a node
+ * Returns the height of the subtree rooted at the node passed as parameter.
+ * The height is cached in the node, so this runs in O(1).
  *
 */
-template <class T>
-int AVLTree<T>::size(Node* n) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::size(Node* n) const {
 	if (n == nullptr)
 		return 0;
+	return n->height;
+}
+
+/*
+ * Recomputes the cached height and balance factor of the node passed as
+ * parameter from those of its children. Must be called bottom-up whenever
+ * the children of a node change.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::update(Node* n) {
 	int left = size(n->left);
 	int right = size(n->right);
-	return 1 + (left < right ? right : left);
+	n->height = 1 + (left < right ? right : left);
+	n->balance = left - right;
+	n->nodes = 1 + weight(n->left) + weight(n->right);
+}
+
+/*
+ * Returns the number of elements in the subtree rooted at the node passed
+ * as parameter. The count is cached in the node, so this runs in O(1).
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::weight(Node* n) const {
+	if (n == nullptr)
+		return 0;
+	return n->nodes;
 }
 
 /*
@@ -351,27 +1451,33 @@ int AVLTree<T>::size(Node* n) const {
  * if its balance factor is different from the values -1, 0, and 1
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::balance(Node*& node) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::balance(Node*& node) {
 
-	node->balance = size(node->left) - size(node->right);
+	update(node);
 
 	int balanceFactor = getBalance(node);
 
-	if (balanceFactor > 1 && getBalance(node->left) >= 0)
+	if (balanceFactor > 1 && getBalance(node->left) >= 0) {
+		stats().rotate(false);
 		return singleRightRotation(node);
+	}
 
 	if (balanceFactor > 1 && getBalance(node->left) < 0)
 	{
+		stats().rotate(true);
 		node->left = singleLeftRotation(node->left);
 		return singleRightRotation(node);
 	}
 
-	if (balanceFactor < -1 && getBalance(node->right) <= 0)
+	if (balanceFactor < -1 && getBalance(node->right) <= 0) {
+		stats().rotate(false);
 		return singleLeftRotation(node);
+	}
 
 	if (balanceFactor < -1 && getBalance(node->right) > 0)
 	{
+		stats().rotate(true);
 		node->right = singleRightRotation(node->right);
 		return singleLeftRotation(node);
 	}
@@ -379,22 +1485,54 @@ typename AVLTree<T>::Node* AVLTree<T>::balance(Node*& node) {
 }
 /*
  * Returns a pointer to the new root node
- * after inserting the object 'e' in the correct place (node)
+ * after inserting the object 'e' in the correct place (node).
+ * 'e' is copied or moved into the tree depending on how it is passed.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class U>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::insert(Node*& node, U&& e) {
+	if (node == nullptr) {
+		node = createNode(std::forward<U>(e));
+		return node;
+	}
+	stats().visit();
+	if (less(e, node->content)) {
+		node->left = insert(node->left, std::forward<U>(e));
+	}
+	else if (greater(e, node->content)) {
+		node->right = insert(node->right, std::forward<U>(e));
+	}
+	else {
+		node->content = std::forward<U>(e);
+		return node;
+	}
+	node = balance(node);
+	return node;
+}
+
+/*
+ * Returns a pointer to the new root node after linking the node 'fresh',
+ * already built, in the correct place. If an equal element is found, it is
+ * move-assigned from 'fresh', which is then destroyed.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::insert(Node*& node, const T& e) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::insertNode(Node*& node, Node* fresh) {
 	if (node == nullptr) {
-		node = new Node(e);
+		node = fresh;
+		return node;
 	}
-	else if (e < node->content) {
-		node->left = insert(node->left, e);
+	stats().visit();
+	if (less(fresh->content, node->content)) {
+		node->left = insertNode(node->left, fresh);
 	}
-	else if (e > node->content) {
-		node->right = insert(node->right, e);
+	else if (greater(fresh->content, node->content)) {
+		node->right = insertNode(node->right, fresh);
 	}
 	else {
-		node->content = e;
+		node->content = std::move(fresh->content);
+		destroyNode(fresh);
 		return node;
 	}
 	node = balance(node);
@@ -406,15 +1544,17 @@ typename AVLTree<T>::Node* AVLTree<T>::insert(Node*& node, const T& e) {
  * passed as parameter
  *
 */
-template <class T>
-const T* AVLTree<T>::searchElem(Node* node, const T& element) const {
+template <class T, template <class> class Pool, class Stats>
+const T* AVLTree<T, Pool, Stats>::searchElem(Node* node, const T& element) const {
 	if (node == nullptr) {
 		return nullptr;
 	}
+	stats().visit();
+	stats().compare();
 	if (element == node->content) {
 		return &(node->content);
 	}
-	if (element < node->content) {
+	if (less(element, node->content)) {
 		return searchElem(node->left, element);
 	}
 	else {
@@ -429,14 +1569,14 @@ const T* AVLTree<T>::searchElem(Node* node, const T& element) const {
  * in the right child of the right subtree.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::singleRightRotation(Node*& subtreeRoot) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::singleRightRotation(Node*& subtreeRoot) {
 	Node* temp = subtreeRoot->left;
 	Node* a = temp->right;
 	temp->right = subtreeRoot;
 	subtreeRoot->left = a;
-	subtreeRoot->balance = size(subtreeRoot->left) - size(subtreeRoot->right);
-	temp->balance = size(temp->left) - size(temp->right);
+	update(subtreeRoot);
+	update(temp);
 	return temp;
 }
 /*
@@ -444,8 +1584,8 @@ typename AVLTree<T>::Node* AVLTree<T>::singleRightRotation(Node*& subtreeRoot) {
  * This rotation is performed when a new node is inserted as the left child of the left subtree.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::singleLeftRotation(Node*& subtreeRoot) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::singleLeftRotation(Node*& subtreeRoot) {
 	Node* temp = subtreeRoot->right;
 
 	Node* a = temp->left;
@@ -453,8 +1593,8 @@ typename AVLTree<T>::Node* AVLTree<T>::singleLeftRotation(Node*& subtreeRoot) {
 	temp->left = subtreeRoot;
 	subtreeRoot->right = a;
 
-	subtreeRoot->balance = size(subtreeRoot->left) - size(subtreeRoot->right);
-	temp->balance = size(temp->left) - size(temp->right);
+	update(subtreeRoot);
+	update(temp);
 
 	return temp;
 }
@@ -465,8 +1605,8 @@ typename AVLTree<T>::Node* AVLTree<T>::singleLeftRotation(Node*& subtreeRoot) {
  * This rotation is performed when a new node is inserted as the right child of the left subtree.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::doubleLeftRotation(Node*& subtreeRoot) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::doubleLeftRotation(Node*& subtreeRoot) {
 	subtreeRoot->left = rotationRightSimple(subtreeRoot->left);
 	return singleLeftRotation(subtreeRoot);
 }
@@ -477,8 +1617,8 @@ typename AVLTree<T>::Node* AVLTree<T>::doubleLeftRotation(Node*& subtreeRoot) {
  * This rotation is performed when a new node is inserted as the left child of the right subtree.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::doubleRightRotation(Node*& subtreeRoot) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::doubleRightRotation(Node*& subtreeRoot) {
 	subtreeRoot->right = singleLeftRotation(subtreeRoot->right);
 	return rotationRightSimple(subtreeRoot);
 }
@@ -488,28 +1628,55 @@ typename AVLTree<T>::Node* AVLTree<T>::doubleRightRotation(Node*& subtreeRoot) {
  * and frees the memory of the nodes.
  *
 */
-template <class T>
-void AVLTree<T>::clear(Node*& node) {
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::clear(Node*& node) {
 
 	if (node != nullptr) {
 		clear(node->right);
 		clear(node->left);
-		delete(node);
+		destroyNode(node);
 	}
 
 	node = nullptr;
 }
+
+/*
+ * Returns a pointer to a new node whose element is built from the
+ * arguments passed as parameters, placed in storage taken from the
+ * node pool.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class... Args>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::createNode(Args&&... args) {
+	stats().allocate();
+	return new (pool.allocate()) Node(std::forward<Args>(args)...);
+}
+
+/*
+ * Destroys the node passed as parameter and gives its storage back to
+ * the node pool.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::destroyNode(Node* node) {
+	stats().free();
+	node->~Node();
+	pool.deallocate(node);
+}
 /*
  * Returns a pointer to the root node of the tree after copying all the nodes
  * of the current tree in the same order. Returns NULL if the node passed as a
  * parameter points to a null object.
  *
 */
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::copy(Node* node) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::copy(Node* node) {
 	if (node != nullptr) {
-		Node* copyNode = new Node(node->content);
+		Node* copyNode = createNode(node->content);
 		copyNode->balance = node->balance;
+		copyNode->height = node->height;
+		copyNode->nodes = node->nodes;
 		Node* left = copy(node->left);
 		Node* right = copy(node->right);
 		copyNode->left = left;
@@ -522,44 +1689,102 @@ typename AVLTree<T>::Node* AVLTree<T>::copy(Node* node) {
 }
 
 /*
- * Returns an object of type Iterator positioned on the element preceding
- * the element e passed as a parameter in the current tree.
+ * Returns a pointer to the root node of a perfectly balanced tree holding
+ * the sorted, duplicate-free elements elems[low..high], which are moved
+ * into the nodes. Returns NULL if the range is empty. Each node is visited once, so this runs in O(n).
  *
 */
-template <class T>
-typename AVLTree<T>::Iterator AVLTree<T>::searchEqualOrPrevious(const T& e) const {
-	Node* last = nullptr;
-	Node* n = root;
-	while (n) {
-		if (e < n->content) {
-			n = n->left;
-		}
-		else if (e > n->content) {
-			last = n;
-			n = n->right;
-		}
-		else {
-			return search(e);
-		}
-	}
-	if (last != nullptr)
-		return search(last->content);
-	return Iterator(*this);
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::build(T* elems, int low, int high) {
+	if (low > high)
+		return nullptr;
+	int middle = low + (high - low) / 2;
+	Node* node = createNode(std::move(elems[middle]));
+	node->left = build(elems, low, middle - 1);
+	node->right = build(elems, middle + 1, high);
+	update(node);
+	return node;
+}
+
+/*
+ * Same as build with nodes that already exist, sorted in ascending order:
+ * they are linked into a perfectly balanced tree in O(n).
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::link(Node** nodes, int low, int high) {
+	if (low > high)
+		return nullptr;
+	int middle = low + (high - low) / 2;
+	Node* node = nodes[middle];
+	node->left = link(nodes, low, middle - 1);
+	node->right = link(nodes, middle + 1, high);
+	update(node);
+	return node;
+}
+
+/*
+ * Helper function of retain_if, walks the subtree passed as parameter in
+ * order, appending to "kept" the nodes whose element satisfies the
+ * predicate and destroying the others.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+template <class Predicate>
+void AVLTree<T, Pool, Stats>::filter(Node* node, Predicate& keep, std::vector<Node*>& kept) {
+	if (node == nullptr)
+		return;
+	stats().visit();
+	Node* right = node->right;
+	filter(node->left, keep, kept);
+	if (keep(const_cast<const T&>(node->content)))
+		kept.push_back(node);
+	else
+		destroyNode(node);
+	filter(right, keep, kept);
+}
+
+/*
+ * Returns an object of type Iterator positioned on the element e passed
+ * as a parameter, or on the element preceding it if e is not in the
+ * current tree, or end() if every element is larger.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::searchEqualOrPrevious(const T& e) const {
+	Iterator iter = upper_bound(e);
+	if (iter == begin())
+		return end();
+	return --iter;
+}
+
+/*
+ * Returns an object of type Iterator positioned on the element e passed
+ * as a parameter, or on the element following it if e is not in the
+ * current tree, or end() if every element is smaller.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::searchEqualOrNext(const T& e) const {
+	return lower_bound(e);
 }
 
 /*
  * Returns an object of type Iterator positioned on the element e to search.
 */
-template <class T>
-typename AVLTree<T>::Iterator AVLTree<T>::search(const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::search(const T& e) const {
+	Scope scope(stats(), OP_LOOKUP);
 	Iterator iter(*this);
 	Node* n = root;
 	while (n) {
-		if (e < n->content) {
-			iter.path.push(n);
+		stats().visit();
+		if (less(e, n->content)) {
+			iter.push(n);
 			n = n->left;
 		}
-		else if (e > n->content) {
+		else if (greater(e, n->content)) {
+			iter.push(n);
 			n = n->right;
 		}
 		else {
@@ -567,79 +1792,213 @@ typename AVLTree<T>::Iterator AVLTree<T>::search(const T& e) const {
 			return iter;
 		}
 	}
-	iter.path.clear();
-	return iter;
+	return end();
 }
 
 /*
  * Returns an object of type Iterator pointing to the end node of the
  * current tree.
 */
-template <class T>
-typename AVLTree<T>::Iterator AVLTree<T>::end() const {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::end() const {
 	return Iterator(*this);
 }
 /************ Iterator ***************/
 
-template <class T>
-AVLTree<T>::Iterator::Iterator(const AVLTree& a) : associated_tree(a), current(nullptr) {
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::Iterator::Iterator() : current(nullptr), associated_tree(nullptr), depth(0) {
+}
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::Iterator::Iterator(const AVLTree& a) : current(nullptr), associated_tree(&a), depth(0) {
+}
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::Iterator::Iterator(const Iterator& i) : current(i.current), associated_tree(i.associated_tree), depth(i.depth) {
+	std::copy(i.path, i.path + i.depth, path);
+}
+
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator& AVLTree<T, Pool, Stats>::Iterator::operator = (const Iterator& i) {
+	current = i.current;
+	associated_tree = i.associated_tree;
+	depth = i.depth;
+	std::copy(i.path, i.path + i.depth, path);
+	return *this;
+}
+
+/*
+ * Records the node passed as parameter as the deepest ancestor of the
+ * node the iterator is about to move to.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::Iterator::push(Node* n) {
+	assert(depth < MAX_DEPTH);
+	path[depth++] = n;
 }
 
-template <class T>
-AVLTree<T>::Iterator::Iterator(const Iterator& i) : associated_tree(i.associated_tree), current(i.current) {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::Iterator::operator++(int) {
+	Iterator old(*this);
+	++(*this);
+	return old;
 }
 
-template <class T>
-typename AVLTree<T>::Iterator AVLTree<T>::Iterator::operator++(int) {
+/*
+ * Moves to the in-order successor: the leftmost node of the right subtree
+ * if there is one, otherwise the closest ancestor reached from its left.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator& AVLTree<T, Pool, Stats>::Iterator::operator++() {
 	assert(current);
-	Node* next = current->right;
-	while (next) {
-		path.push(next);
-		next = next->left;
+	Scope scope(associated_tree->stats(), OP_ITERATE);
+	int moves = 1;
+	if (current->right != nullptr) {
+		push(current);
+		current = current->right;
+		while (current->left != nullptr) {
+			push(current);
+			current = current->left;
+			moves++;
+		}
+		associated_tree->stats().visit(moves);
+		return *this;
 	}
-	if (!path.empty())
-		current = path.pop();
-	else
-		current = nullptr;
+	Node* child = current;
+	current = nullptr;
+	while (depth > 0) {
+		Node* parent = path[--depth];
+		if (parent->left == child) {
+			current = parent;
+			break;
+		}
+		child = parent;
+		moves++;
+	}
+	associated_tree->stats().visit(moves);
 	return *this;
 }
 
-template <class T>
-typename AVLTree<T>::Iterator& AVLTree<T>::Iterator::operator++() {
-	assert(current);
-	Node* next = current->right;
-	while (next) {
-		path.push(next);
-		next = next->left;
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::Iterator::operator--(int) {
+	Iterator old(*this);
+	--(*this);
+	return old;
+}
+
+/*
+ * Moves to the in-order predecessor. Decrementing end() moves to the
+ * largest element of the tree.
+ *
+*/
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator& AVLTree<T, Pool, Stats>::Iterator::operator--() {
+	assert(associated_tree);
+	Scope scope(associated_tree->stats(), OP_ITERATE);
+	int moves = 1;
+	if (current == nullptr) {
+		depth = 0;
+		current = associated_tree->root;
+		while (current != nullptr && current->right != nullptr) {
+			push(current);
+			current = current->right;
+			moves++;
+		}
+		associated_tree->stats().visit(moves);
+		return *this;
 	}
-	if (!path.empty())
-		current = path.pop();
-	else
-		current = nullptr;
+	if (current->left != nullptr) {
+		push(current);
+		current = current->left;
+		while (current->right != nullptr) {
+			push(current);
+			current = current->right;
+			moves++;
+		}
+		associated_tree->stats().visit(moves);
+		return *this;
+	}
+	Node* child = current;
+	current = nullptr;
+	while (depth > 0) {
+		Node* parent = path[--depth];
+		if (parent->right == child) {
+			current = parent;
+			break;
+		}
+		child = parent;
+		moves++;
+	}
+	associated_tree->stats().visit(moves);
 	return *this;
 }
 
-template <class T>
-AVLTree<T>::Iterator::operator bool() const {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator::reference AVLTree<T, Pool, Stats>::Iterator::operator*() const {
+	assert(current);
+	return current->content;
+}
+
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator::pointer AVLTree<T, Pool, Stats>::Iterator::operator->() const {
+	assert(current);
+	return &(current->content);
+}
+
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::Iterator::operator == (const Iterator& other) const {
+	return current == other.current;
+}
+
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::Iterator::operator != (const Iterator& other) const {
+	return current != other.current;
+}
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::Iterator::operator bool() const {
 	return current != nullptr;
 }
 
+/************ Range ***************/
+
+template <class T, template <class> class Pool, class Stats>
+AVLTree<T, Pool, Stats>::Range::Range(const Iterator& f, const Iterator& l) : first(f), last(l) {
+}
+
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::Range::begin() const {
+	return first;
+}
+
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Iterator AVLTree<T, Pool, Stats>::Range::end() const {
+	return last;
+}
+
+template <class T, template <class> class Pool, class Stats>
+bool AVLTree<T, Pool, Stats>::Range::empty() const {
+	return first == last;
+}
+
 /************ Test Functions ***************/
 
 #include <climits>
 
-template <class T>
-int AVLTree<T>::size() const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::size() const {
 	return count(root);
 }
 
-template <class T>
-int AVLTree<T>::height() const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::height() const {
 	return height(root);
 }
 
-template <class T>
-int AVLTree<T>::balance(const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::balance(const T& e) const {
 	int bal = INT_MIN;
 	if (contains(e)) {
 		Node* n = find(e);
@@ -648,8 +2007,8 @@ int AVLTree<T>::balance(const T& e) const {
 	return bal;
 }
 
-template <class T>
-int AVLTree<T>::get_balance(const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::get_balance(const T& e) const {
 	int bal = INT_MIN;
 	if (contains(e)) {
 		Node* n = find(e);
@@ -658,20 +2017,20 @@ int AVLTree<T>::get_balance(const T& e) const {
 	return bal;
 }
 
-template <class T>
-int AVLTree<T>::occurrence(const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::occurrence(const T& e) const {
 	return occurrence(root, e);
 }
 
-template <class T>
-int AVLTree<T>::count(Node* n) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::count(Node* n) const {
 	if (n == nullptr)
 		return 0;
 	return 1 + count(n->left) + count(n->right);
 }
 
-template <class T>
-typename AVLTree<T>::Node* AVLTree<T>::find(const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+typename AVLTree<T, Pool, Stats>::Node* AVLTree<T, Pool, Stats>::find(const T& e) const {
 	Node* n = root;
 	while (n != nullptr && n->content != e) {
 		if (n->content > e)
@@ -682,8 +2041,8 @@ typename AVLTree<T>::Node* AVLTree<T>::find(const T& e) const {
 	return n;
 }
 
-template <class T>
-int AVLTree<T>::height(Node* n) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::height(Node* n) const {
 	if (n == nullptr)
 		return 0;
 	int l = height(n->left);
@@ -693,8 +2052,8 @@ int AVLTree<T>::height(Node* n) const {
 	return 1 + (l < r ? r : l);
 }
 
-template <class T>
-int AVLTree<T>::occurrence(Node* n, const T& e) const {
+template <class T, template <class> class Pool, class Stats>
+int AVLTree<T, Pool, Stats>::occurrence(Node* n, const T& e) const {
 	int o = 0;
 	if (n != nullptr) {
 		if (n->content == e)
@@ -705,8 +2064,8 @@ int AVLTree<T>::occurrence(Node* n, const T& e) const {
 }
 #include <iostream>
 
-template <class T>
-void AVLTree<T>::display() const {
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::display() const {
 	std::cout << "Content of the tree (";
 	int n = size();
 	std::cout << n << " nodes)\n";
@@ -731,8 +2090,8 @@ void AVLTree<T>::display() const {
 	std::cout << "-------------" << std::endl;
 }
 
-template <class T>
-void AVLTree<T>::prepareDisplay(const Node* n, int depth, int& index, T* elements, int* depths) const {
+template <class T, template <class> class Pool, class Stats>
+void AVLTree<T, Pool, Stats>::prepareDisplay(const Node* n, int depth, int& index, T* elements, int* depths) const {
 	if (n == nullptr) return;
 	prepareDisplay(n->left, depth + 1, index, elements, depths);
 	elements[index] = n->data;
@@ -0,0 +1,489 @@
+// benchmark.cpp : Benchmark suite for the AVLTree and Library classes.
+//
+
+/*
+
+Builds synthetic catalogs of n books for n = 10^3, 10^4, ... up to the
+limit passed as first argument (default 10^6, use 100000000 for 10^8) and
+four ISBN distributions:
+	sequential	increasing ISBNs
+	random		uniformly distributed ISBNs
+	skewed		ISBNs crowded at the low end of the range
+	duplicates	every ISBN appears about 16 times
+
+For each catalog, times insert, contains, find (one by one, batched and on
+the frozen layout), building the author and title indexes and querying
+them, ISBN range scans, iterate, copy (of the tree, and of a Library, which
+shares it), equality, merge and remove, and prints ns/op, ns/op divided by
+log2(n) (roughly constant for the O(log n) operations), throughput and the
+peak resident set size of the process so far. The catalog is also written to a temporary
+file and loaded back with Library::load on every core, reporting each
+stage of the pipeline (map, parse, merge, build) per book, then saved to
+and restored from a binary snapshot.
+
+Finally, the same mix of inserts, removes and lookups is run on 1, 2, 4...
+threads against an AVLTree behind a mutex and a ConcurrentAVLTree, which
+must end up with the same books. Built by the "avl-benchmark" CMake target
+(configure with -DAVL_STATISTICS=ON to also print the operation counters
+of each catalog):
+
+	cmake -S . -B build -DCMAKE_BUILD_TYPE=Release
+	cmake --build build --target avl-benchmark
+	./build/avl-benchmark 100000000
+*/
+
+#include "library.h"
+#include "concurrenttree.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/*
+ * Returns the peak resident set size of the process in megabytes, or 0
+ * where it cannot be measured.
+ */
+static double peakRssMb() {
+#if defined(__APPLE__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#elif defined(__unix__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * 64-bit xorshift generator, so the catalogs do not depend on <random>
+ * and are identical on every platform.
+ */
+class Generator {
+public:
+	Generator(unsigned long long seed) : x(seed) {
+	}
+	unsigned long long next() {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		return x;
+	}
+	double uniform() {
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	unsigned long long x;
+};
+
+static const unsigned long FIRST_ISBN = 9780000000000UL;
+
+enum Distribution { SEQUENTIAL, RANDOM, SKEWED, DUPLICATES };
+static const char* DISTRIBUTION_NAMES[] = { "sequential", "random", "skewed", "duplicates" };
+
+/*
+ * Returns n ISBNs following the distribution passed as parameter.
+ */
+static std::vector<unsigned long> makeIsbns(Distribution d, size_t n, unsigned long long seed) {
+	Generator gen(seed);
+	std::vector<unsigned long> isbns(n);
+	for (size_t i = 0; i < n; i++) {
+		switch (d) {
+		case SEQUENTIAL:
+			isbns[i] = FIRST_ISBN + i;
+			break;
+		case RANDOM:
+			isbns[i] = FIRST_ISBN + gen.next() % (1000 * (unsigned long long)n);
+			break;
+		case SKEWED: {
+			double u = gen.uniform();
+			isbns[i] = FIRST_ISBN + (unsigned long)(u * u * u * u * 1000.0 * n);
+			break;
+		}
+		case DUPLICATES:
+			isbns[i] = FIRST_ISBN + gen.next() % (n / 16 + 1);
+			break;
+		}
+	}
+	return isbns;
+}
+
+/*
+ * Returns the Books of a catalog built on the ISBNs passed as parameter.
+ */
+static std::vector<Book> makeBooks(const std::vector<unsigned long>& isbns) {
+	std::vector<Book> books;
+	books.reserve(isbns.size());
+	for (size_t i = 0; i < isbns.size(); i++)
+		books.push_back(Book(isbns[i], "Author " + std::to_string(isbns[i] % 1000), "Title " + std::to_string(isbns[i]), 1 + (int)(i % 7)));
+	return books;
+}
+
+/*
+ * Times a list of operations and prints one line per operation.
+ */
+class Timer {
+public:
+	Timer(const char* d, size_t n) : distribution(d), size(n) {
+	}
+	void start() {
+		begin = std::chrono::steady_clock::now();
+	}
+	void stop(const char* operation, size_t ops) {
+		report(operation, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count(), ops);
+	}
+	void report(const char* operation, double ns, size_t ops) {
+		double perOp = ops ? ns / ops : 0;
+		std::cout << std::left << std::setw(12) << distribution
+			<< std::right << std::setw(11) << size
+			<< "  " << std::left << std::setw(11) << operation << std::right
+			<< std::setw(11) << std::fixed << std::setprecision(1) << perOp
+			<< std::setw(10) << std::setprecision(2) << (size > 1 ? perOp / std::log2((double)size) : 0)
+			<< std::setw(12) << std::setprecision(2) << (perOp > 0 ? 1000.0 / perOp : 0)
+			<< std::setw(11) << std::setprecision(1) << peakRssMb() << std::endl;
+	}
+
+private:
+	const char* distribution;
+	size_t size;
+	std::chrono::steady_clock::time_point begin;
+};
+
+/*
+ * Keeps the optimizer from discarding the results of timed loops.
+ */
+static volatile long long sink;
+
+static void run(Distribution d, size_t n) {
+	std::vector<Book> books = makeBooks(makeIsbns(d, n, 88172645463325252ULL));
+	std::vector<unsigned long> probes = makeIsbns(d, n, 2463534242ULL);
+	Timer timer(DISTRIBUTION_NAMES[d], n);
+
+	AVLTree<Book> tree;
+	timer.start();
+	for (size_t i = 0; i < n; i++)
+		tree.insert(books[i]);
+	timer.stop("insert", n);
+
+	long long hits = 0;
+	timer.start();
+	for (size_t i = 0; i < n; i++)
+		hits += tree.contains(books[i]) ? 1 : 0;
+	timer.stop("contains", n);
+
+	Library library;
+	for (size_t i = 0; i < n; i++)
+		library.insert(books[i]);
+	timer.start();
+	for (size_t i = 0; i < n; i++)
+		hits += library.find(probes[i]).copies();
+	timer.stop("find", n);
+
+	std::vector<const Book*> found(n);
+	timer.start();
+	library.find_batch(probes.data(), n, found.data());
+	for (size_t i = 0; i < n; i++)
+		hits += found[i] ? found[i]->copies() : 0;
+	timer.stop("find_batch", n);
+	std::unique_ptr<bool[]> present(new bool[n]);
+	library.contains_batch(probes.data(), n, present.get());
+	for (size_t i = 0; i < n; i++) {
+		const Book& expected = library.find(probes[i]);
+		if ((found[i] != nullptr) != present[i] || (found[i] != nullptr ? found[i] != &expected : expected.copies() != 0)) {
+			std::cerr << "FAILURE - batched lookups disagree with find" << std::endl;
+			std::exit(1);
+		}
+	}
+
+	timer.start();
+	FrozenTree<Book> frozen = library.freeze();
+	timer.stop("freeze", n);
+	timer.start();
+	for (size_t i = 0; i < n; i++) {
+		const Book* b = frozen.lookup(probes[i]);
+		hits += b ? b->copies() : 0;
+	}
+	timer.stop("frozen", n);
+	for (size_t i = 0; i < n; i++) {
+		const Book* b = frozen.lookup(probes[i]);
+		if ((b ? b->copies() : 0) != library.find(probes[i]).copies()) {
+			std::cerr << "FAILURE - frozen lookups disagree with find" << std::endl;
+			std::exit(1);
+		}
+	}
+
+	Library indexed = library;
+	timer.start();
+	indexed.set_indexes(Library::AUTHOR_INDEX | Library::TITLE_INDEX);
+	timer.stop("index", n);
+	size_t queries = n < 1000 ? n : 1000;
+	timer.start();
+	for (size_t i = 0; i < queries; i++)
+		hits += indexed.by_author("Author " + std::to_string(i)).size();
+	timer.stop("by_author", queries);
+	timer.start();
+	for (size_t i = 0; i < queries; i++)
+		hits += indexed.by_title_prefix("Title " + std::to_string(probes[i] / 100), 10).size();
+	timer.stop("by_title", queries);
+
+	size_t scanned = 0;
+	long long counted = 0;
+	timer.start();
+	for (size_t i = 0; i < queries; i++) {
+		for (const Book& b : library.range(probes[i], probes[i] + 100000)) {
+			hits += b.copies();
+			scanned++;
+		}
+	}
+	timer.stop("range", scanned);
+	for (size_t i = 0; i < queries; i++)
+		counted += library.count_range(probes[i], probes[i] + 100000);
+	if (counted != (long long)scanned) {
+		std::cerr << "FAILURE - range scans disagree with count_range" << std::endl;
+		std::exit(1);
+	}
+
+	timer.start();
+	size_t visited = 0;
+	for (const Book& b : tree) {
+		hits += b.copies();
+		visited++;
+	}
+	timer.stop("iterate", visited);
+
+	long long copies = 0;
+	int stocked = 0;
+	timer.start();
+	for (const Book& b : library.range(0, ULONG_MAX)) {
+		copies += b.copies();
+		stocked += b.copies() > 1 ? 1 : 0;
+	}
+	timer.stop("sum", visited);
+	timer.start();
+	long long parallel = library.total_copies();
+	timer.stop("sum:par", visited);
+	if (parallel != copies || library.count_if([](const Book& b) { return b.copies() > 1; }) != stocked) {
+		std::cerr << "FAILURE - parallel reductions disagree with iteration" << std::endl;
+		std::exit(1);
+	}
+
+	timer.start();
+	AVLTree<Book> copy = tree;
+	timer.stop("copy", visited);
+
+	timer.start();
+	Library shared = library;
+	timer.stop("copy:lib", 1);
+	hits += shared.find(probes[0]).copies();
+
+	timer.start();
+	hits += (copy == tree) ? 1 : 0;
+	timer.stop("equality", visited);
+
+	if (visited > 0) {
+		Book low = *copy.select((int)visited / 4);
+		Book high = *copy.select((int)(3 * visited / 4));
+		int expected = copy.count_range(low, high);
+		timer.start();
+		int erased = copy.erase_range(low, high);
+		timer.stop("erase_range", erased);
+		int odd = 0;
+		for (const Book& b : copy)
+			odd += b.copies() % 2;
+		timer.start();
+		int dropped = copy.retain_if([](const Book& b) { return b.copies() % 2 == 0; });
+		timer.stop("retain_if", visited - erased);
+		if (erased != expected || dropped != odd || copy.count_range(low, high) != 0) {
+			std::cerr << "FAILURE - bulk removals disagree with count_range" << std::endl;
+			std::exit(1);
+		}
+	}
+
+	Library other = library;
+	timer.start();
+	library.merge(other);
+	timer.stop("merge", visited);
+
+	timer.start();
+	for (size_t i = 0; i < n; i++)
+		tree.remove(books[i]);
+	timer.stop("remove", n);
+
+	std::string path = (std::filesystem::temp_directory_path() / "avl-benchmark-catalog.txt").string();
+	{
+		std::ofstream out(path);
+		for (size_t i = 0; i < n; i++)
+			out << "Title " << books[i].copies() << ';' << probes[i] << ";Author;" << books[i].copies() << '\n';
+	}
+	Library loaded;
+	std::vector<CatalogError> errors;
+	LoadTimings timings;
+	bool read = loaded.load(path, errors, 0, &timings);
+	std::remove(path.c_str());
+	std::vector<unsigned long> distinct = probes;
+	std::sort(distinct.begin(), distinct.end());
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+	long long written = 0;
+	for (size_t i = 0; i < n; i++)
+		written += books[i].copies();
+	if (!read || !errors.empty() || loaded.count_range(0, ULONG_MAX) != (int)distinct.size() || loaded.total_copies() != written) {
+		std::cerr << "FAILURE - loaded catalog differs from the file" << std::endl;
+		std::exit(1);
+	}
+	timer.report("load:map", timings.map * 1e9, n);
+	timer.report("load:parse", timings.parse * 1e9, n);
+	timer.report("load:merge", timings.merge * 1e9, n);
+	timer.report("load:build", timings.build * 1e9, n);
+
+	timer.start();
+	bool saved = loaded.save(path);
+	timer.stop("save", n);
+	Library restored;
+	timer.start();
+	bool reloaded = restored.restore(path);
+	timer.stop("restore", n);
+	std::remove(path.c_str());
+	if (!saved || !reloaded || !(restored == loaded) || restored.total_copies() != loaded.total_copies()) {
+		std::cerr << "FAILURE - restored snapshot differs from the library" << std::endl;
+		std::exit(1);
+	}
+
+	if (DefaultStats::enabled)
+		std::cout << library.statistics();
+	std::cout << "memory: " << library.memory_usage() << std::endl;
+
+	sink = hits;
+	if (!tree.isEmpty()) {
+		std::cerr << "FAILURE - tree not empty after removals" << std::endl;
+		std::exit(1);
+	}
+}
+
+/*
+ * Calls apply(kind, book) for the "ops" operations of worker w out of
+ * "threads": 70% inserts, 10% removes and 20% lookups ("i", "r", "c")
+ * among "keys" ISBNs. A worker only inserts and removes ISBNs equal to w
+ * modulo "threads", so the final content does not depend on how the
+ * workers interleave.
+ */
+template <class Apply>
+static void workload(unsigned w, unsigned threads, size_t ops, size_t keys, Apply apply) {
+	Generator gen(88172645463325252ULL + w);
+	size_t owned = keys / threads + 1;
+	for (size_t i = 0; i < ops; i++) {
+		unsigned long long r = gen.next();
+		unsigned long mine = FIRST_ISBN + (unsigned long)((r >> 8) % owned) * threads + w;
+		switch (r % 10) {
+		case 0:
+			apply('r', Book(mine));
+			break;
+		case 1:
+		case 2:
+			apply('c', Book(FIRST_ISBN + (r >> 8) % keys));
+			break;
+		default:
+			apply('i', Book(mine, "Author", "Title", 1 + (int)(r % 3)));
+			break;
+		}
+	}
+}
+
+/*
+ * Times the workload on "threads" threads against both trees, then checks
+ * that they hold the same books with the same copies.
+ */
+static void scale(size_t n, unsigned threads) {
+	std::string label = "threads:" + std::to_string(threads);
+	Timer timer(label.c_str(), n);
+	size_t keys = n / 4 + 1;
+	size_t ops = n / threads;
+	std::vector<std::thread> workers;
+
+	AVLTree<Book> locked;
+	std::mutex lock;
+	timer.start();
+	for (unsigned w = 0; w < threads; w++) {
+		workers.push_back(std::thread([&, w]() {
+			workload(w, threads, ops, keys, [&](char kind, Book&& b) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (kind == 'i')
+					locked.insert(std::move(b));
+				else if (kind == 'r')
+					locked.remove(b);
+				else
+					sink = locked.contains(b);
+			});
+		}));
+	}
+	for (std::thread& t : workers)
+		t.join();
+	timer.stop("locked", ops * threads);
+	workers.clear();
+
+	ConcurrentAVLTree<Book> concurrent;
+	timer.start();
+	for (unsigned w = 0; w < threads; w++) {
+		workers.push_back(std::thread([&, w]() {
+			workload(w, threads, ops, keys, [&](char kind, Book&& b) {
+				if (kind == 'i')
+					concurrent.insert(std::move(b));
+				else if (kind == 'r')
+					concurrent.remove(b);
+				else
+					sink = concurrent.contains(b);
+			});
+		}));
+	}
+	for (std::thread& t : workers)
+		t.join();
+	timer.stop("concurrent", ops * threads);
+
+	AVLTree<Book>::Iterator expected = locked.begin();
+	bool same = concurrent.size() == locked.size();
+	concurrent.for_each([&](const Book& b) {
+		if (!same || !expected || *expected != b || expected->copies() != b.copies())
+			same = false;
+		else
+			++expected;
+	});
+	if (!same || expected) {
+		std::cerr << "FAILURE - concurrent tree differs from the locked one" << std::endl;
+		std::exit(1);
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t limit = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+	size_t first = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+	std::cout << std::left << std::setw(12) << "catalog"
+		<< std::right << std::setw(11) << "n"
+		<< "  " << std::left << std::setw(11) << "operation" << std::right
+		<< std::setw(11) << "ns/op"
+		<< std::setw(10) << "/log2(n)"
+		<< std::setw(12) << "Mops/s"
+		<< std::setw(11) << "peak MB" << std::endl;
+	for (int d = SEQUENTIAL; d <= DUPLICATES; d++) {
+		for (size_t n = first; n <= limit; n *= 10)
+			run((Distribution)d, n);
+	}
+	unsigned cores = std::thread::hardware_concurrency();
+	for (unsigned threads = 1; threads <= (cores > 8 ? cores : 8); threads *= 2)
+		scale(limit < 1000000 ? limit : 1000000, threads);
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Secondary index of a Library.
+ *
+ * An ordered set of (key, isbn) entries, the key being the author or the
+ * title of a Book. Each entry points at the Book stored in the primary
+ * tree instead of holding a copy of it, so an entry costs a Text handle,
+ * an ISBN and a pointer. Entries with the same key are ordered by ISBN.
+ *
+ * The index does not watch the primary tree: the Library updates it each
+ * time a Book is added, changed, moved or removed.
+ */
+
+#ifndef __BOOKINDEX_H__
+#define __BOOKINDEX_H__
+
+#include "avltree.h"
+#include "textarena.h"
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class Book;
+
+struct IndexEntry {
+    Text key;
+    unsigned long isbn;
+    const Book* record;
+
+    bool operator == (const IndexEntry&) const;
+    bool operator != (const IndexEntry&) const;
+    bool operator < (const IndexEntry&) const;
+    bool operator > (const IndexEntry&) const;
+};
+
+/*
+ * Search key of the index: a string that is not necessarily in the text
+ * storage, and the smallest ISBN wanted.
+ */
+struct IndexProbe {
+    std::string_view key;
+    unsigned long isbn;
+};
+
+bool operator < (const IndexEntry&, const IndexProbe&);
+
+class BookIndex {
+public:
+    /*
+     * Adds the entry (key, isbn), or points the existing one at
+     * "record", in O(log n).
+     */
+    void add(Text key, unsigned long isbn, const Book* record);
+    void remove(Text key, unsigned long isbn);
+    /*
+     * Replaces the content of the index with the given entries, in any
+     * order, in O(n log n).
+     */
+    void build(std::vector<IndexEntry>& entries);
+
+    /*
+     * Range scans in O(log n + k), calling f(record) for each entry in
+     * key order:
+     * 		equal		entries whose key is the string passed
+     * 		prefix		entries whose key starts with the string passed,
+     * 				stopping after "limit" of them
+     */
+    template <class F>
+    void equal(std::string_view, F f) const;
+    template <class F>
+    void prefix(std::string_view, size_t limit, F f) const;
+
+    MemoryUsage memory_usage() const;
+
+private:
+    AVLTree<IndexEntry> entries;
+};
+
+/************ IndexEntry ***************/
+
+bool IndexEntry::operator == (const IndexEntry& other) const {
+    return isbn == other.isbn && key.view() == other.key.view();
+}
+
+bool IndexEntry::operator != (const IndexEntry& other) const {
+    return !(*this == other);
+}
+
+bool IndexEntry::operator < (const IndexEntry& other) const {
+    int order = key.view().compare(other.key.view());
+    return order < 0 || (order == 0 && isbn < other.isbn);
+}
+
+bool IndexEntry::operator > (const IndexEntry& other) const {
+    return other < *this;
+}
+
+bool operator < (const IndexEntry& entry, const IndexProbe& probe) {
+    int order = entry.key.view().compare(probe.key);
+    return order < 0 || (order == 0 && entry.isbn < probe.isbn);
+}
+
+/************ BookIndex ***************/
+
+void BookIndex::add(Text key, unsigned long isbn, const Book* record) {
+    entries.insert(IndexEntry{ key, isbn, record });
+}
+
+void BookIndex::remove(Text key, unsigned long isbn) {
+    entries.remove(IndexEntry{ key, isbn, nullptr });
+}
+
+void BookIndex::build(std::vector<IndexEntry>& list) {
+    entries.build(list.begin(), list.end());
+}
+
+MemoryUsage BookIndex::memory_usage() const {
+    return entries.memory_usage();
+}
+
+template <class F>
+void BookIndex::equal(std::string_view key, F f) const {
+    for (AVLTree<IndexEntry>::Iterator i = entries.lower_bound(IndexProbe{ key, 0 }); i && i->key.view() == key; ++i)
+        f(i->record);
+}
+
+template <class F>
+void BookIndex::prefix(std::string_view start, size_t limit, F f) const {
+    AVLTree<IndexEntry>::Iterator i = entries.lower_bound(IndexProbe{ start, 0 });
+    for (size_t found = 0; found < limit && i && i->key.view().substr(0, start.size()) == start; ++i, ++found)
+        f(i->record);
+}
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * Catalog parsing.
+ *
+ * Reads catalogs in the "title;isbn;author;total" format of
+ * "exemple_librairie_a.txt" straight from memory: separators are found in
+ * place, numbers are converted with std::from_chars and each Book is built
+ * from views on the buffer. Malformed lines are reported with their line
+ * number and skipped, nothing is thrown.
+ */
+
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include "book.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * A malformed catalog line: its number (from 1) and what is wrong with it.
+ */
+struct CatalogError {
+    size_t line;
+    std::string message;
+};
+
+/*
+ * The fields of a catalog line. The strings are views on the parsed
+ * buffer, nothing is copied until the Book is built: then the author is
+ * interned and the title stored by the writer passed, without any
+ * temporary std::string.
+ */
+struct BookFields {
+    std::string_view title;
+    unsigned long isbn;
+    std::string_view author;
+    int total;
+
+    Book book(TextArena::Writer&) const;
+};
+
+/*
+ * A piece of catalog parsed on its own: the Books in order of appearance,
+ * pointers to them sorted by ISBN (stable), the malformed lines with
+ * numbers relative to the chunk and the number of lines of the chunk.
+ * The Books are sorted through pointers because moving a Book onto another
+ * one with the same ISBN adds up their copies.
+ */
+struct CatalogChunk {
+    std::vector<Book> books;
+    std::vector<Book*> order;
+    std::vector<CatalogError> errors;
+    size_t lines;
+};
+
+/*
+ * Wall-clock time spent in each stage of Library::load, in seconds.
+ */
+struct LoadTimings {
+    double map;
+    double parse;
+    double merge;
+    double build;
+};
+
+/*
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /*
+     * Maps the file passed as parameter, unmapping the previous one.
+     * Returns "false" if the file cannot be opened or mapped.
+     */
+    bool open(const std::string&);
+    void close();
+    const char* data() const;
+    size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator = (const MappedFile&);
+
+    const char* begin;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+/*
+ * Parses one line, without its end of line. Returns "true" and fills
+ * "fields" if the line is well formed, otherwise returns "false" and
+ * sets "error" to a static description of the problem.
+ */
+bool parseBook(std::string_view line, BookFields& fields, const char*& error);
+
+/*
+ * Parses every line of the buffer [begin, end) and passes each Book to
+ * sink(Book&&), its text written by "text". Blank lines are ignored, malformed ones are appended to
+ * "errors". Line numbers start at "firstLine". Returns the number of
+ * Books passed to the sink.
+ */
+template <class Sink>
+size_t parseCatalog(const char* begin, const char* end, TextArena::Writer& text, Sink sink, std::vector<CatalogError>& errors, size_t firstLine = 1);
+
+/*
+ * Returns the boundaries of "count" chunks of the buffer [begin, end),
+ * each one ending right after an end of line (except the last one).
+ */
+std::vector<const char*> splitCatalog(const char* begin, const char* end, size_t count);
+
+/*
+ * Parses and sorts the chunk [begin, end) into "chunk", storing the text
+ * of its Books in "text".
+ */
+void parseChunk(const char* begin, const char* end, CatalogChunk& chunk, TextArena& text);
+
+/*
+ * Merges sorted chunks into one vector sorted by ISBN. Books with the same
+ * ISBN are combined with the assignment operator of Book, in order of
+ * appearance in the catalog, so their copies are added up.
+ */
+void mergeChunks(std::vector<CatalogChunk>& chunks, std::vector<Book>& merged);
+
+/************ MappedFile ***************/
+
+MappedFile::MappedFile() : begin(nullptr), length(0) {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        close();
+        return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    if (length == 0)
+        return true;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        close();
+        return false;
+    }
+    begin = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (begin == nullptr) {
+        close();
+        return false;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)status.st_size;
+    if (length > 0) {
+        void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        madvise(address, length, MADV_SEQUENTIAL);
+        begin = static_cast<const char*>(address);
+    }
+    ::close(fd);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (begin != nullptr)
+        UnmapViewOfFile(begin);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (begin != nullptr)
+        munmap(const_cast<char*>(begin), length);
+#endif
+    begin = nullptr;
+    length = 0;
+}
+
+const char* MappedFile::data() const {
+    return begin;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+/************ Parsing ***************/
+
+Book BookFields::book(TextArena::Writer& text) const {
+    return Book(isbn, text.intern(author), text.store(title), total, text.reference());
+}
+
+/*
+ * Returns the field passed as parameter without its leading and
+ * trailing blanks.
+ */
+static std::string_view trimField(std::string_view field) {
+    while (!field.empty() && (field.front() == ' ' || field.front() == '\t'))
+        field.remove_prefix(1);
+    while (!field.empty() && (field.back() == ' ' || field.back() == '\t'))
+        field.remove_suffix(1);
+    return field;
+}
+
+/*
+ * Converts the whole field passed as parameter to a number. Returns
+ * "false" if the field is empty, is not a number, or does not fit.
+ */
+template <class N>
+static bool parseNumber(std::string_view field, N& value) {
+    field = trimField(field);
+    if (field.empty())
+        return false;
+    std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
+
+bool parseBook(std::string_view line, BookFields& fields, const char*& error) {
+    size_t first = line.find(';');
+    if (first == std::string_view::npos) {
+        error = "missing ';' after the title";
+        return false;
+    }
+    size_t second = line.find(';', first + 1);
+    if (second == std::string_view::npos) {
+        error = "missing ';' after the ISBN";
+        return false;
+    }
+    size_t third = line.find(';', second + 1);
+    if (third == std::string_view::npos) {
+        error = "missing ';' after the author";
+        return false;
+    }
+    if (!parseNumber(line.substr(first + 1, second - first - 1), fields.isbn)) {
+        error = "invalid ISBN";
+        return false;
+    }
+    if (!parseNumber(line.substr(third + 1), fields.total)) {
+        error = "invalid number of copies";
+        return false;
+    }
+    fields.title = line.substr(0, first);
+    fields.author = line.substr(second + 1, third - second - 1);
+    return true;
+}
+
+template <class Sink>
+size_t parseCatalog(const char* begin, const char* end, TextArena::Writer& text, Sink sink, std::vector<CatalogError>& errors, size_t firstLine) {
+    size_t parsed = 0;
+    size_t number = firstLine;
+    BookFields fields;
+    while (begin < end) {
+        const char* eol = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        if (eol == nullptr)
+            eol = end;
+        std::string_view line(begin, eol - begin);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (!trimField(line).empty()) {
+            const char* error;
+            if (parseBook(line, fields, error)) {
+                sink(fields.book(text));
+                parsed++;
+            }
+            else {
+                errors.push_back(CatalogError{ number, error });
+            }
+        }
+        begin = eol + 1;
+        number++;
+    }
+    return parsed;
+}
+
+std::vector<const char*> splitCatalog(const char* begin, const char* end, size_t count) {
+    std::vector<const char*> bounds;
+    bounds.push_back(begin);
+    for (size_t i = 1; i < count; i++) {
+        const char* p = begin + (end - begin) * i / count;
+        if (p < bounds.back())
+            p = bounds.back();
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        bounds.push_back(eol == nullptr ? end : eol + 1);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+void parseChunk(const char* begin, const char* end, CatalogChunk& chunk, TextArena& text) {
+    TextArena::Writer writer(text);
+    parseCatalog(begin, end, writer, [&chunk](Book&& b) {
+        chunk.books.push_back(std::move(b));
+    }, chunk.errors);
+    chunk.lines = std::count(begin, end, '\n');
+    chunk.order.reserve(chunk.books.size());
+    for (size_t i = 0; i < chunk.books.size(); i++)
+        chunk.order.push_back(&chunk.books[i]);
+    std::stable_sort(chunk.order.begin(), chunk.order.end(),
+        [](const Book* a, const Book* b) { return *a < *b; });
+}
+
+void mergeChunks(std::vector<CatalogChunk>& chunks, std::vector<Book>& merged) {
+    typedef std::pair<size_t, size_t> Cursor;
+    // Smallest ISBN first, then earliest chunk.
+    auto later = [&chunks](const Cursor& a, const Cursor& b) {
+        const Book& x = *chunks[a.first].order[a.second];
+        const Book& y = *chunks[b.first].order[b.second];
+        if (y < x)
+            return true;
+        if (x < y)
+            return false;
+        return a.first > b.first;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heads(later);
+    size_t total = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        total += chunks[c].order.size();
+        if (!chunks[c].order.empty())
+            heads.push(Cursor(c, 0));
+    }
+    merged.reserve(merged.size() + total);
+    while (!heads.empty()) {
+        Cursor head = heads.top();
+        heads.pop();
+        Book& b = *chunks[head.first].order[head.second];
+        if (!merged.empty() && merged.back() == b)
+            merged.back() = std::move(b);
+        else
+            merged.push_back(std::move(b));
+        if (++head.second < chunks[head.first].order.size())
+            heads.push(head);
+    }
+}
+
+#endif
@@ -0,0 +1,979 @@
+/*
+ * ConcurrentAVLTree Class.
+ *
+ * AVL tree that any number of threads may insert into, remove from and
+ * search at the same time, after "A Practical Concurrent Binary Search
+ * Tree" (Bronson, Casper, Chafi, Olukotun, PPoPP 2010):
+ *
+ * 		- searches take no lock. Every node has a version number that a
+ * 		  rotation changes when it moves the node down; a search reads the
+ * 		  version of a node before following one of its children and checks
+ * 		  it again afterwards (optimistic hand-over-hand validation), and
+ * 		  retries from the parent if the node moved in between
+ * 		- updates lock the node they link a leaf under, or the parent and
+ * 		  the node they unlink, parents always before children
+ * 		- balancing is relaxed: heights are repaired and rotations are done
+ * 		  after the update, on the way up, by the thread that damaged them
+ * 		- removing an element whose node has two children only marks the
+ * 		  node as a routing node; routing nodes are unlinked during
+ * 		  rebalancing once they have at most one child
+ *
+ * Unlike the original, the element of a linked node never changes: an
+ * insert of an equal element (which is assigned to a copy of the current
+ * one, as with AVLTree::insert) or of a removed one replaces the whole
+ * node, so searches never read an element while it is written. Replaced
+ * and unlinked nodes are freed once no operation that started before
+ * their removal is still running (epoch-based reclamation).
+ *
+ * T must be default-constructible (for the sentinel above the root).
+ */
+
+#ifndef __CONCURRENTTREE_H__
+#define __CONCURRENTTREE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <class T>
+class ConcurrentAVLTree {
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    /*
+     * Thread-safe operations, with the semantics of the AVLTree functions
+     * of the same name. lookup returns a copy of the element equal to the
+     * key, or nothing if there is none. The copy is constructed, never
+     * assigned, since assigning a Book to one with the same ISBN adds up
+     * their copies.
+     */
+    void insert(const T&);
+    void insert(T&&);
+    void remove(const T&);
+    bool contains(const T&) const;
+    template <class K>
+    std::optional<T> lookup(const K&) const;
+    int size() const;
+    bool isEmpty() const;
+
+    /*
+     * These functions must not run concurrently with any other one.
+     * for_each calls f(element) on every element in increasing order.
+     */
+    void clear();
+    template <class F>
+    void for_each(F f) const;
+
+private:
+    struct Node {
+        template <class... Args>
+        Node(Args&&... args);
+        T content;
+        std::atomic<bool> present;
+        std::atomic<int> height;
+        std::atomic<uint64_t> version;
+        std::atomic<Node*> parent;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::mutex lock;
+    };
+
+    /*
+     * Version of a node: UNLINKED once it has left the tree, otherwise a
+     * count of the rotations that moved it down, shifted by 2, with the
+     * SHRINKING bit set while one is in progress.
+     */
+    static const uint64_t UNLINKED = 1;
+    static const uint64_t SHRINKING = 2;
+    static const uint64_t SHRINK_COUNT = 4;
+    static const int SPIN_COUNT = 100;
+
+    /*
+     * Results of nodeCondition other than a new height.
+     */
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    /*
+     * Announces the epoch an operation started in, for its duration.
+     */
+    class Guard {
+    public:
+        Guard(const ConcurrentAVLTree&);
+        ~Guard();
+    private:
+        std::atomic<uint64_t>* slot;
+    };
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch;
+    };
+    static const size_t READER_SLOTS = 64;
+    static const size_t RECLAIM_BATCH = 1024;
+
+    template <class K>
+    static int compare(const K&, const T&);
+    static std::atomic<Node*>& child(Node*, int);
+    static int height(Node*);
+    static void waitUntilChanged(Node*, uint64_t);
+
+    template <class K>
+    Node* search(const K&) const;
+    template <class K>
+    bool attemptSearch(const K&, Node*, int, uint64_t, Node*&) const;
+    template <class U>
+    void update(U&&);
+    template <class U>
+    bool attemptInsertIntoEmpty(U&&);
+    template <class U>
+    bool attemptInsert(U&&, Node*, Node*, uint64_t);
+    template <class U>
+    bool attemptReplace(U&&, Node*, Node*);
+    bool attemptRemove(const T&, Node*, Node*, uint64_t);
+    bool attemptRemoveNode(Node*, Node*);
+    bool attemptUnlink(Node*, Node*);
+
+    int nodeCondition(Node*);
+    void fixHeightAndRebalance(Node*);
+    Node* fixHeight(Node*);
+    Node* rebalance(Node*, Node*, Node*&);
+    Node* rebalanceToRight(Node*, Node*, Node*, int);
+    Node* rebalanceToLeft(Node*, Node*, Node*, int);
+    Node* rotateRight(Node*, Node*, Node*, int, int, Node*, int);
+    Node* rotateLeft(Node*, Node*, int, Node*, Node*, int, int);
+    Node* rotateRightOverLeft(Node*, Node*, Node*, int, int, Node*, int);
+    Node* rotateLeftOverRight(Node*, Node*, int, Node*, Node*, int, int);
+
+    void retire(Node*);
+    void reclaim();
+    void destroy(Node*);
+    template <class F>
+    void for_each(Node*, F&) const;
+
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator = (const ConcurrentAVLTree&);
+
+    /*
+     * Sentinel whose right child is the root.
+     */
+    Node holder;
+    std::atomic<int> count;
+    std::atomic<uint64_t> epoch;
+    mutable Slot readers[READER_SLOTS];
+    std::mutex retiredLock;
+    std::vector<std::pair<Node*, uint64_t> > retired;
+    /*
+     * Size of "retired" that triggers the next reclaim, twice what the
+     * last one kept, so nodes pinned by a slow operation are not scanned
+     * again at every retire.
+     */
+    size_t reclaimAt;
+};
+
+/************ Public Functions ***************/
+
+template <class T>
+template <class... Args>
+ConcurrentAVLTree<T>::Node::Node(Args&&... args) : content(std::forward<Args>(args)...), present(true), height(1), version(0), parent(nullptr), left(nullptr), right(nullptr) {
+}
+
+template <class T>
+ConcurrentAVLTree<T>::ConcurrentAVLTree() : count(0), epoch(1), reclaimAt(RECLAIM_BATCH) {
+    holder.present = false;
+    for (size_t i = 0; i < READER_SLOTS; i++)
+        readers[i].epoch.store(0);
+}
+
+template <class T>
+ConcurrentAVLTree<T>::~ConcurrentAVLTree() {
+    clear();
+}
+
+template <class T>
+void ConcurrentAVLTree<T>::insert(const T& e) {
+    update(e);
+}
+
+template <class T>
+void ConcurrentAVLTree<T>::insert(T&& e) {
+    update(std::move(e));
+}
+
+template <class T>
+void ConcurrentAVLTree<T>::remove(const T& e) {
+    Guard guard(*this);
+    for (;;) {
+        Node* right = holder.right.load();
+        if (right == nullptr)
+            return;
+        uint64_t v = right->version.load();
+        if (v & (SHRINKING | UNLINKED))
+            waitUntilChanged(right, v);
+        else if (right == holder.right.load() && attemptRemove(e, &holder, right, v))
+            return;
+    }
+}
+
+template <class T>
+bool ConcurrentAVLTree<T>::contains(const T& e) const {
+    Guard guard(*this);
+    Node* n = search(e);
+    return n != nullptr && n->present.load();
+}
+
+template <class T>
+template <class K>
+std::optional<T> ConcurrentAVLTree<T>::lookup(const K& key) const {
+    Guard guard(*this);
+    Node* n = search(key);
+    if (n == nullptr || !n->present.load())
+        return std::nullopt;
+    return std::optional<T>(std::in_place, n->content);
+}
+
+template <class T>
+int ConcurrentAVLTree<T>::size() const {
+    return count.load();
+}
+
+template <class T>
+bool ConcurrentAVLTree<T>::isEmpty() const {
+    return count.load() == 0;
+}
+
+template <class T>
+void ConcurrentAVLTree<T>::clear() {
+    destroy(holder.right.load());
+    holder.right = nullptr;
+    for (size_t i = 0; i < retired.size(); i++)
+        delete retired[i].first;
+    retired.clear();
+    count = 0;
+}
+
+template <class T>
+template <class F>
+void ConcurrentAVLTree<T>::for_each(F f) const {
+    for_each(holder.right.load(), f);
+}
+
+/************ Private Functions ***************/
+
+template <class T>
+ConcurrentAVLTree<T>::Guard::Guard(const ConcurrentAVLTree& tree) {
+    uint64_t announced = tree.epoch.load();
+    size_t i = std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_SLOTS;
+    for (;;) {
+        uint64_t idle = 0;
+        if (tree.readers[i].epoch.compare_exchange_weak(idle, announced))
+            break;
+        i = (i + 1) % READER_SLOTS;
+    }
+    slot = &tree.readers[i].epoch;
+}
+
+template <class T>
+ConcurrentAVLTree<T>::Guard::~Guard() {
+    slot->store(0);
+}
+
+/*
+ * Returns -1, 0 or 1 as the key is smaller than, equal to or larger
+ * than the element.
+ */
+template <class T>
+template <class K>
+int ConcurrentAVLTree<T>::compare(const K& key, const T& e) {
+    if (key < e)
+        return -1;
+    if (e < key)
+        return 1;
+    return 0;
+}
+
+template <class T>
+std::atomic<typename ConcurrentAVLTree<T>::Node*>& ConcurrentAVLTree<T>::child(Node* n, int dir) {
+    return dir < 0 ? n->left : n->right;
+}
+
+template <class T>
+int ConcurrentAVLTree<T>::height(Node* n) {
+    return n == nullptr ? 0 : n->height.load();
+}
+
+/*
+ * Waits for the end of the rotation moving the node down, if any. The
+ * rotating thread holds the lock of the node.
+ */
+template <class T>
+void ConcurrentAVLTree<T>::waitUntilChanged(Node* n, uint64_t v) {
+    if ((v & SHRINKING) == 0)
+        return;
+    for (int i = 0; i < SPIN_COUNT; i++) {
+        if (n->version.load() != v)
+            return;
+    }
+    std::lock_guard<std::mutex> guard(n->lock);
+}
+
+/*
+ * Returns the node holding the key, present or routing, or NULL.
+ */
+template <class T>
+template <class K>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::search(const K& key) const {
+    for (;;) {
+        Node* right = holder.right.load();
+        if (right == nullptr)
+            return nullptr;
+        int c = compare(key, right->content);
+        if (c == 0)
+            return right;
+        uint64_t v = right->version.load();
+        Node* found;
+        if (v & (SHRINKING | UNLINKED))
+            waitUntilChanged(right, v);
+        else if (right == holder.right.load() && attemptSearch(key, right, c, v, found))
+            return found;
+    }
+}
+
+/*
+ * Searches the subtree in direction "dir" of the node, whose version was
+ * "nodeVersion" when it was reached. Returns "false" if the node has been
+ * moved down or unlinked since, so the search must resume from its parent.
+ */
+template <class T>
+template <class K>
+bool ConcurrentAVLTree<T>::attemptSearch(const K& key, Node* node, int dir, uint64_t nodeVersion, Node*& found) const {
+    for (;;) {
+        Node* c = child(node, dir).load();
+        if (c == nullptr) {
+            if (node->version.load() != nodeVersion)
+                return false;
+            found = nullptr;
+            return true;
+        }
+        int next = compare(key, c->content);
+        if (next == 0) {
+            found = c;
+            return true;
+        }
+        uint64_t v = c->version.load();
+        if (v & (SHRINKING | UNLINKED)) {
+            waitUntilChanged(c, v);
+            if (node->version.load() != nodeVersion)
+                return false;
+        }
+        else if (c != child(node, dir).load()) {
+            if (node->version.load() != nodeVersion)
+                return false;
+        }
+        else {
+            if (node->version.load() != nodeVersion)
+                return false;
+            if (attemptSearch(key, c, next, v, found))
+                return true;
+        }
+    }
+}
+
+template <class T>
+template <class U>
+void ConcurrentAVLTree<T>::update(U&& e) {
+    Guard guard(*this);
+    for (;;) {
+        Node* right = holder.right.load();
+        if (right == nullptr) {
+            if (attemptInsertIntoEmpty(std::forward<U>(e)))
+                return;
+        }
+        else {
+            uint64_t v = right->version.load();
+            if (v & (SHRINKING | UNLINKED))
+                waitUntilChanged(right, v);
+            else if (right == holder.right.load() && attemptInsert(std::forward<U>(e), &holder, right, v))
+                return;
+        }
+    }
+}
+
+/*
+ * The element is only forwarded into a node once the insertion cannot
+ * fail any more, so every retry still sees it intact.
+ */
+template <class T>
+template <class U>
+bool ConcurrentAVLTree<T>::attemptInsertIntoEmpty(U&& e) {
+    std::lock_guard<std::mutex> guard(holder.lock);
+    if (holder.right.load() != nullptr)
+        return false;
+    Node* n = new Node(std::forward<U>(e));
+    n->parent = &holder;
+    holder.right = n;
+    count++;
+    return true;
+}
+
+template <class T>
+template <class U>
+bool ConcurrentAVLTree<T>::attemptInsert(U&& e, Node* parent, Node* node, uint64_t nodeVersion) {
+    int dir = compare(e, node->content);
+    if (dir == 0)
+        return attemptReplace(std::forward<U>(e), parent, node);
+    for (;;) {
+        Node* c = child(node, dir).load();
+        if (node->version.load() != nodeVersion)
+            return false;
+        if (c == nullptr) {
+            Node* damaged;
+            {
+                std::lock_guard<std::mutex> guard(node->lock);
+                if (node->version.load() != nodeVersion)
+                    return false;
+                if (child(node, dir).load() != nullptr)
+                    continue;
+                Node* leaf = new Node(std::forward<U>(e));
+                leaf->parent = node;
+                child(node, dir) = leaf;
+                count++;
+                damaged = fixHeight(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return true;
+        }
+        uint64_t v = c->version.load();
+        if (v & (SHRINKING | UNLINKED)) {
+            waitUntilChanged(c, v);
+        }
+        else if (c == child(node, dir).load()) {
+            if (node->version.load() != nodeVersion)
+                return false;
+            if (attemptInsert(std::forward<U>(e), node, c, v))
+                return true;
+        }
+    }
+}
+
+/*
+ * Replaces the node holding an element equal to "e" by a new node holding
+ * a copy of that element assigned "e", or "e" itself if the node was a
+ * routing node. The new node takes over the links, and the repairs the
+ * old one may still need.
+ */
+template <class T>
+template <class U>
+bool ConcurrentAVLTree<T>::attemptReplace(U&& e, Node* parent, Node* node) {
+    Node* fresh;
+    {
+        std::lock_guard<std::mutex> parentGuard(parent->lock);
+        if (parent->version.load() == UNLINKED || node->parent.load() != parent)
+            return false;
+        std::lock_guard<std::mutex> nodeGuard(node->lock);
+        if (node->version.load() == UNLINKED ||
+            (parent->left.load() != node && parent->right.load() != node))
+            return false;
+        if (node->present.load()) {
+            T combined(node->content);
+            combined = std::forward<U>(e);
+            fresh = new Node(std::move(combined));
+        }
+        else {
+            fresh = new Node(std::forward<U>(e));
+            count++;
+        }
+        Node* l = node->left.load();
+        Node* r = node->right.load();
+        fresh->left = l;
+        fresh->right = r;
+        fresh->height = node->height.load();
+        fresh->parent = parent;
+        if (l != nullptr)
+            l->parent = fresh;
+        if (r != nullptr)
+            r->parent = fresh;
+        if (parent->left.load() == node)
+            parent->left = fresh;
+        else
+            parent->right = fresh;
+        node->version = UNLINKED;
+    }
+    retire(node);
+    fixHeightAndRebalance(fresh);
+    return true;
+}
+
+template <class T>
+bool ConcurrentAVLTree<T>::attemptRemove(const T& e, Node* parent, Node* node, uint64_t nodeVersion) {
+    int dir = compare(e, node->content);
+    if (dir == 0)
+        return attemptRemoveNode(parent, node);
+    for (;;) {
+        Node* c = child(node, dir).load();
+        if (node->version.load() != nodeVersion)
+            return false;
+        if (c == nullptr)
+            return true;
+        uint64_t v = c->version.load();
+        if (v & (SHRINKING | UNLINKED)) {
+            waitUntilChanged(c, v);
+        }
+        else if (c == child(node, dir).load()) {
+            if (node->version.load() != nodeVersion)
+                return false;
+            if (attemptRemove(e, node, c, v))
+                return true;
+        }
+    }
+}
+
+/*
+ * A node with at most one child is unlinked, under the locks of its
+ * parent and itself. A node with two children becomes a routing node.
+ */
+template <class T>
+bool ConcurrentAVLTree<T>::attemptRemoveNode(Node* parent, Node* node) {
+    if (!node->present.load())
+        return true;
+    if (node->left.load() == nullptr || node->right.load() == nullptr) {
+        Node* damaged;
+        {
+            std::lock_guard<std::mutex> parentGuard(parent->lock);
+            if (parent->version.load() == UNLINKED || node->parent.load() != parent)
+                return false;
+            std::lock_guard<std::mutex> nodeGuard(node->lock);
+            if (node->version.load() == UNLINKED)
+                return false;
+            if (!node->present.load())
+                return true;
+            if (!attemptUnlink(parent, node))
+                return false;
+            count--;
+            damaged = fixHeight(parent);
+        }
+        retire(node);
+        fixHeightAndRebalance(damaged);
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(node->lock);
+    if (node->version.load() == UNLINKED)
+        return false;
+    if (!node->present.load())
+        return true;
+    if (node->left.load() == nullptr || node->right.load() == nullptr)
+        return false;
+    node->present = false;
+    count--;
+    return true;
+}
+
+/*
+ * Splices out a node with at most one child. Both the parent and the node
+ * must be locked. Returns "false" if the node is no longer a child of the
+ * parent or now has two children.
+ */
+template <class T>
+bool ConcurrentAVLTree<T>::attemptUnlink(Node* parent, Node* node) {
+    Node* parentLeft = parent->left.load();
+    Node* parentRight = parent->right.load();
+    if (parentLeft != node && parentRight != node)
+        return false;
+    Node* l = node->left.load();
+    Node* r = node->right.load();
+    if (l != nullptr && r != nullptr)
+        return false;
+    Node* splice = l != nullptr ? l : r;
+    if (parentLeft == node)
+        parent->left = splice;
+    else
+        parent->right = splice;
+    if (splice != nullptr)
+        splice->parent = parent;
+    node->version = UNLINKED;
+    node->present = false;
+    return true;
+}
+
+/*
+ * Returns the new height the node needs, UNLINK_REQUIRED for a routing
+ * node with at most one child, REBALANCE_REQUIRED if its children differ
+ * by more than 1 in height, or NOTHING_REQUIRED. A thread that changes a
+ * node promises to repair it, so an inconsistent read is not a problem.
+ */
+template <class T>
+int ConcurrentAVLTree<T>::nodeCondition(Node* n) {
+    Node* l = n->left.load();
+    Node* r = n->right.load();
+    if ((l == nullptr || r == nullptr) && !n->present.load())
+        return UNLINK_REQUIRED;
+    int h = n->height.load();
+    int hl = height(l);
+    int hr = height(r);
+    int repaired = 1 + (hl < hr ? hr : hl);
+    int bal = hl - hr;
+    if (bal < -1 || bal > 1)
+        return REBALANCE_REQUIRED;
+    return h != repaired ? repaired : NOTHING_REQUIRED;
+}
+
+/*
+ * Repairs the node passed as parameter and then its ancestors until no
+ * more repair is needed, or another thread is responsible for it.
+ */
+template <class T>
+void ConcurrentAVLTree<T>::fixHeightAndRebalance(Node* node) {
+    while (node != nullptr && node->parent.load() != nullptr) {
+        int condition = nodeCondition(node);
+        if (condition == NOTHING_REQUIRED || node->version.load() == UNLINKED)
+            return;
+        Node* unlinked = nullptr;
+        if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            std::lock_guard<std::mutex> guard(node->lock);
+            if (node->version.load() == UNLINKED)
+                return;
+            node = fixHeight(node);
+        }
+        else {
+            Node* nParent = node->parent.load();
+            std::lock_guard<std::mutex> parentGuard(nParent->lock);
+            if (nParent->version.load() != UNLINKED && node->parent.load() == nParent) {
+                std::lock_guard<std::mutex> nodeGuard(node->lock);
+                if (node->version.load() == UNLINKED)
+                    return;
+                node = rebalance(nParent, node, unlinked);
+            }
+        }
+        if (unlinked != nullptr)
+            retire(unlinked);
+    }
+}
+
+/*
+ * Updates the height of a locked node. Returns the next node to repair:
+ * the node itself if it needs more than a new height, its parent if its
+ * height changed, or NULL.
+ */
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::fixHeight(Node* node) {
+    int c = nodeCondition(node);
+    switch (c) {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return nullptr;
+    default:
+        node->height = c;
+        return node->parent.load();
+    }
+}
+
+/*
+ * Unlinks, rotates or updates the height of "n", both it and its parent
+ * being locked. A routing node unlinked here is returned in "unlinked".
+ * Returns the next node to repair, or NULL.
+ */
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rebalance(Node* nParent, Node* n, Node*& unlinked) {
+    Node* nL = n->left.load();
+    Node* nR = n->right.load();
+    if ((nL == nullptr || nR == nullptr) && !n->present.load()) {
+        if (attemptUnlink(nParent, n)) {
+            unlinked = n;
+            return fixHeight(nParent);
+        }
+        return n;
+    }
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + (hL0 < hR0 ? hR0 : hL0);
+    int bal = hL0 - hR0;
+    if (bal > 1)
+        return rebalanceToRight(nParent, n, nL, hR0);
+    if (bal < -1)
+        return rebalanceToLeft(nParent, n, nR, hL0);
+    if (hNRepl != hN) {
+        n->height = hNRepl;
+        return fixHeight(nParent);
+    }
+    return nullptr;
+}
+
+/*
+ * The left child of "n" is too high: rotates "n" right, after rotating
+ * its left child left if the inner grandchild is the higher one.
+ */
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rebalanceToRight(Node* nParent, Node* n, Node* nL, int hR0) {
+    std::lock_guard<std::mutex> leftGuard(nL->lock);
+    int hL = nL->height.load();
+    if (hL - hR0 <= 1)
+        return n;
+    Node* nLR = nL->right.load();
+    int hLL0 = height(nL->left.load());
+    int hLR0 = height(nLR);
+    if (hLL0 >= hLR0)
+        return rotateRight(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+    {
+        std::lock_guard<std::mutex> innerGuard(nLR->lock);
+        int hLR = nLR->height.load();
+        if (hLL0 >= hLR)
+            return rotateRight(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        int hLRL = height(nLR->left.load());
+        int b = hLL0 - hLRL;
+        if (b >= -1 && b <= 1 && !((hLL0 == 0 || hLRL == 0) && !nL->present.load()))
+            return rotateRightOverLeft(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+    }
+    // A double rotation would leave nL damaged: repair it on its own first.
+    return rebalanceToLeft(n, nL, nLR, hLL0);
+}
+
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rebalanceToLeft(Node* nParent, Node* n, Node* nR, int hL0) {
+    std::lock_guard<std::mutex> rightGuard(nR->lock);
+    int hR = nR->height.load();
+    if (hL0 - hR >= -1)
+        return n;
+    Node* nRL = nR->left.load();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->right.load());
+    if (hRR0 >= hRL0)
+        return rotateLeft(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+    {
+        std::lock_guard<std::mutex> innerGuard(nRL->lock);
+        int hRL = nRL->height.load();
+        if (hRR0 >= hRL)
+            return rotateLeft(nParent, n, hL0, nR, nRL, hRL, hRR0);
+        int hRLR = height(nRL->right.load());
+        int b = hRR0 - hRLR;
+        if (b >= -1 && b <= 1 && !((hRR0 == 0 || hRLR == 0) && !nR->present.load()))
+            return rotateLeftOverRight(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+    }
+    return rebalanceToRight(n, nR, nRL, hRR0);
+}
+
+/*
+ * The rotations relink the nodes in an order that keeps every concurrent
+ * search correct except those at "n", which see its version change.
+ * They return the deepest node they left damaged, or go on repairing
+ * the parent.
+ */
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rotateRight(Node* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR) {
+    uint64_t v = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version = v | SHRINKING;
+    n->left = nLR;
+    if (nLR != nullptr)
+        nLR->parent = n;
+    nL->right = n;
+    n->parent = nL;
+    if (nPL == n)
+        nParent->left = nL;
+    else
+        nParent->right = nL;
+    nL->parent = nParent;
+    int hNRepl = 1 + (hLR < hR ? hR : hLR);
+    n->height = hNRepl;
+    nL->height = 1 + (hLL < hNRepl ? hNRepl : hLL);
+    n->version = v + SHRINK_COUNT;
+
+    int balN = hLR - hR;
+    if (balN < -1 || balN > 1)
+        return n;
+    if ((nLR == nullptr || hR == 0) && !n->present.load())
+        return n;
+    int balL = hLL - hNRepl;
+    if (balL < -1 || balL > 1)
+        return nL;
+    if (hLL == 0 && !nL->present.load())
+        return nL;
+    return fixHeight(nParent);
+}
+
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rotateLeft(Node* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR) {
+    uint64_t v = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version = v | SHRINKING;
+    n->right = nRL;
+    if (nRL != nullptr)
+        nRL->parent = n;
+    nR->left = n;
+    n->parent = nR;
+    if (nPL == n)
+        nParent->left = nR;
+    else
+        nParent->right = nR;
+    nR->parent = nParent;
+    int hNRepl = 1 + (hL < hRL ? hRL : hL);
+    n->height = hNRepl;
+    nR->height = 1 + (hNRepl < hRR ? hRR : hNRepl);
+    n->version = v + SHRINK_COUNT;
+
+    int balN = hRL - hL;
+    if (balN < -1 || balN > 1)
+        return n;
+    if ((nRL == nullptr || hL == 0) && !n->present.load())
+        return n;
+    int balR = hRR - hNRepl;
+    if (balR < -1 || balR > 1)
+        return nR;
+    if (hRR == 0 && !nR->present.load())
+        return nR;
+    return fixHeight(nParent);
+}
+
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rotateRightOverLeft(Node* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL) {
+    uint64_t v = n->version.load();
+    uint64_t leftVersion = nL->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nLRL = nLR->left.load();
+    Node* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+    n->version = v | SHRINKING;
+    nL->version = leftVersion | SHRINKING;
+    n->left = nLRR;
+    if (nLRR != nullptr)
+        nLRR->parent = n;
+    nL->right = nLRL;
+    if (nLRL != nullptr)
+        nLRL->parent = nL;
+    nLR->left = nL;
+    nL->parent = nLR;
+    nLR->right = n;
+    n->parent = nLR;
+    if (nPL == n)
+        nParent->left = nLR;
+    else
+        nParent->right = nLR;
+    nLR->parent = nParent;
+    int hNRepl = 1 + (hLRR < hR ? hR : hLRR);
+    n->height = hNRepl;
+    int hLRepl = 1 + (hLL < hLRL ? hLRL : hLL);
+    nL->height = hLRepl;
+    nLR->height = 1 + (hLRepl < hNRepl ? hNRepl : hLRepl);
+    n->version = v + SHRINK_COUNT;
+    nL->version = leftVersion + SHRINK_COUNT;
+
+    int balN = hLRR - hR;
+    if (balN < -1 || balN > 1)
+        return n;
+    if ((nLRR == nullptr || hR == 0) && !n->present.load())
+        return n;
+    int balLR = hLRepl - hNRepl;
+    if (balLR < -1 || balLR > 1)
+        return nLR;
+    return fixHeight(nParent);
+}
+
+template <class T>
+typename ConcurrentAVLTree<T>::Node* ConcurrentAVLTree<T>::rotateLeftOverRight(Node* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR) {
+    uint64_t v = n->version.load();
+    uint64_t rightVersion = nR->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nRLL = nRL->left.load();
+    Node* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+    n->version = v | SHRINKING;
+    nR->version = rightVersion | SHRINKING;
+    n->right = nRLL;
+    if (nRLL != nullptr)
+        nRLL->parent = n;
+    nR->left = nRLR;
+    if (nRLR != nullptr)
+        nRLR->parent = nR;
+    nRL->right = nR;
+    nR->parent = nRL;
+    nRL->left = n;
+    n->parent = nRL;
+    if (nPL == n)
+        nParent->left = nRL;
+    else
+        nParent->right = nRL;
+    nRL->parent = nParent;
+    int hNRepl = 1 + (hL < hRLL ? hRLL : hL);
+    n->height = hNRepl;
+    int hRRepl = 1 + (hRLR < hRR ? hRR : hRLR);
+    nR->height = hRRepl;
+    nRL->height = 1 + (hNRepl < hRRepl ? hRRepl : hNRepl);
+    n->version = v + SHRINK_COUNT;
+    nR->version = rightVersion + SHRINK_COUNT;
+
+    int balN = hRLL - hL;
+    if (balN < -1 || balN > 1)
+        return n;
+    if ((nRLL == nullptr || hL == 0) && !n->present.load())
+        return n;
+    int balRL = hRRepl - hNRepl;
+    if (balRL < -1 || balRL > 1)
+        return nRL;
+    return fixHeight(nParent);
+}
+
+/*
+ * Queues a node that left the tree, tagged with the current epoch, and
+ * frees the queued nodes that no running operation can reach any more.
+ */
+template <class T>
+void ConcurrentAVLTree<T>::retire(Node* n) {
+    std::lock_guard<std::mutex> guard(retiredLock);
+    retired.push_back(std::make_pair(n, epoch.fetch_add(1)));
+    if (retired.size() >= reclaimAt) {
+        reclaim();
+        reclaimAt = 2 * retired.size() > RECLAIM_BATCH ? 2 * retired.size() : RECLAIM_BATCH;
+    }
+}
+
+/*
+ * A node retired in epoch r is unreachable for every operation that
+ * announced an epoch > r. retiredLock must be held.
+ */
+template <class T>
+void ConcurrentAVLTree<T>::reclaim() {
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < READER_SLOTS; i++) {
+        uint64_t e = readers[i].epoch.load();
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].second < oldest)
+            delete retired[i].first;
+        else
+            retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+}
+
+template <class T>
+void ConcurrentAVLTree<T>::destroy(Node* n) {
+    if (n != nullptr) {
+        destroy(n->left.load());
+        destroy(n->right.load());
+        delete n;
+    }
+}
+
+template <class T>
+template <class F>
+void ConcurrentAVLTree<T>::for_each(Node* n, F& f) const {
+    if (n != nullptr) {
+        for_each(n->left.load(), f);
+        if (n->present.load())
+            f(static_cast<const T&>(n->content));
+        for_each(n->right.load(), f);
+    }
+}
+
+#endif
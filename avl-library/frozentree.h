@@ -0,0 +1,129 @@
+/*
+ * FrozenTree Class.
+ *
+ * Immutable snapshot of a sorted set, stored in one contiguous array in
+ * Eytzinger (breadth-first) order: the children of position k are at
+ * 2k and 2k + 1. A search touches one array instead of chasing pointers
+ * across the heap, has no data-dependent branch, and prefetches the
+ * 16 descendants four levels below the current position while it
+ * compares. They are contiguous, and every cache line they span is
+ * prefetched, so elements larger than 4 bytes are covered too.
+ */
+
+#ifndef __FROZENTREE_H__
+#define __FROZENTREE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "prefetch.h"
+
+template <class T>
+class FrozenTree {
+public:
+    FrozenTree();
+    /*
+     * Builds the snapshot from the range [first, last), which must be
+     * sorted in increasing order without duplicates.
+     */
+    template <class ForwardIt>
+    FrozenTree(ForwardIt first, ForwardIt last);
+
+    /*
+     * Returns a pointer to the element equal to the key passed as
+     * parameter, or NULL if there is none. As with AVLTree::lookup,
+     * the key may be of any type comparable with T through "<".
+     */
+    template <class K>
+    const T* lookup(const K&) const;
+    bool contains(const T&) const;
+    int size() const;
+
+private:
+    void place(const std::vector<const T*>&, size_t&, size_t, std::vector<size_t>&) const;
+    /*
+     * Prefetches the descendants of position k four levels down.
+     */
+    void prefetch(size_t k) const;
+
+    static const size_t CACHE_LINE = 64;
+
+    /*
+     * elements[k - 1] holds the element at Eytzinger position k.
+     */
+    std::vector<T> elements;
+};
+
+template <class T>
+FrozenTree<T>::FrozenTree() {
+}
+
+template <class T>
+template <class ForwardIt>
+FrozenTree<T>::FrozenTree(ForwardIt first, ForwardIt last) {
+    std::vector<const T*> sorted;
+    for (; first != last; ++first)
+        sorted.push_back(&*first);
+    std::vector<size_t> position(sorted.size() + 1);
+    size_t next = 0;
+    place(sorted, next, 1, position);
+    elements.reserve(sorted.size());
+    for (size_t k = 1; k <= sorted.size(); k++)
+        elements.push_back(*sorted[position[k]]);
+}
+
+/*
+ * Assigns the sorted elements, in order, to the positions of the subtree
+ * rooted at position k by an in-order walk of the implicit tree.
+ */
+template <class T>
+void FrozenTree<T>::place(const std::vector<const T*>& sorted, size_t& next, size_t k, std::vector<size_t>& position) const {
+    if (k > sorted.size())
+        return;
+    place(sorted, next, 2 * k, position);
+    position[k] = next++;
+    place(sorted, next, 2 * k + 1, position);
+}
+
+template <class T>
+template <class K>
+const T* FrozenTree<T>::lookup(const K& key) const {
+    const T* e = elements.data();
+    size_t n = elements.size();
+    size_t k = 1;
+    while (k <= n) {
+        if (16 * k <= n)
+            prefetch(k);
+        k = 2 * k + (e[k - 1] < key ? 1 : 0);
+    }
+    // Undo the right turns taken after the last left turn: k is then the
+    // position of the first element not smaller than the key, or 0.
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+    if (k == 0 || key < e[k - 1])
+        return nullptr;
+    return &e[k - 1];
+}
+
+template <class T>
+void FrozenTree<T>::prefetch(size_t k) const {
+    const T* first = elements.data() + 16 * k - 1;
+    const T* last = elements.data() + (16 * k + 15 < elements.size() ? 16 * k + 15 : elements.size()) - 1;
+    uintptr_t line = reinterpret_cast<uintptr_t>(first) & ~(uintptr_t)(CACHE_LINE - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(last + 1);
+    for (; line < end; line += CACHE_LINE)
+        AVL_PREFETCH(reinterpret_cast<const char*>(line));
+}
+
+template <class T>
+bool FrozenTree<T>::contains(const T& element) const {
+    return lookup(element) != nullptr;
+}
+
+template <class T>
+int FrozenTree<T>::size() const {
+    return (int)elements.size();
+}
+
+#endif
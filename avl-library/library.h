@@ -9,15 +9,52 @@
 
 #include "avltree.h"
 #include "book.h"
+#include "bookindex.h"
+#include "catalog.h"
+#include "snapshot.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 class Library {
 	/**** You are not allowed to modify the public interface of this class ******/
 	/**** You are not allowed to add public functions or modify the signatures of public functions **********/
 public:
+	/*
+	 * The author and title of the Books of a library live in its
+	 * text storage (see textarena.h). A Book copied out of the
+	 * library keeps that storage alive, but references, pointers
+	 * and iterators into the library must not outlive it.
+	 */
 	Library();
+	/*
+	 * Copies share the tree of the original in O(1). The first
+	 * modification of a library sharing its tree copies it, in O(n),
+	 * and rebuilds its indexes. Sharing is not synchronized: a library
+	 * and its copies must not be used from several threads while one
+	 * of them is modified. Copies are not snapshots for concurrent
+	 * readers; a catalog searched by several threads while another
+	 * one updates it belongs in a ConcurrentAVLTree (see
+	 * concurrenttree.h), which searches without locking.
+	 */
+	Library(const Library&);
+	Library(Library&&);
 	~Library();
 	Library& operator = (const Library&);
+	Library& operator = (Library&&);
+	/*
+	 * Exchange the books of two libraries in O(1).
+	 */
+	void swap(Library&);
 
 	/*
 	 * Insert a Book in the library.
@@ -26,95 +63,758 @@ public:
 	 * as a parameter.
 	 */
 	void insert(Book&);
+	void insert(Book&&);
+	/*
+	 * Remove a Book from the library, whatever its "total" field.
+	 * Nothing happens if the Book is not in the library.
+	 */
+	void remove(const Book&);
+	/*
+	 * Bulk removals, returning the number of books removed:
+	 * 		erase_range	books with low <= ISBN <= high, in O(log n)
+	 * 				plus the cost of freeing them
+	 * 		retain_if	books for which keep(book) is "false", in one
+	 * 				pass over the catalog
+	 * The books left keep their addresses, so the secondary indexes
+	 * only lose the entries of the books removed.
+	 */
+	int erase_range(unsigned long, unsigned long);
+	template <class Predicate>
+	int retain_if(Predicate keep);
+	/*
+	 * Insert every Book of a catalog stream, one Book per line
+	 * in the "title;isbn;author;total" format. Malformed lines
+	 * are skipped and reported in "errors" with their number,
+	 * as by the parser of catalog.h. If the library is empty,
+	 * the tree is bulk-built in linear time when the catalog
+	 * is sorted by ISBN (it is sorted first otherwise).
+	 */
+	void load(std::istream&, std::vector<CatalogError>& errors);
+	/*
+	 * Same as load, reading a catalog file through a memory
+	 * mapping with the in-place parser of catalog.h. Malformed
+	 * lines are skipped and reported in "errors". Return "false"
+	 * if the file cannot be read.
+	 *
+	 * The file is split at line boundaries into chunks that are
+	 * parsed and sorted on "threads" threads (by default 0: one
+	 * per core). The chunks are then merged, adding up the copies
+	 * of equal ISBNs, and the tree is built in one pass. The time
+	 * spent in each stage is stored in "timings" if it is not NULL.
+	 */
+	bool load(const std::string&, std::vector<CatalogError>& errors, unsigned threads = 0, LoadTimings* timings = nullptr);
+	/*
+	 * Write the library to a binary snapshot file (see snapshot.h).
+	 * Return "false" if the file cannot be written.
+	 */
+	bool save(const std::string&) const;
+	/*
+	 * Replace the content of the library with a snapshot written
+	 * by save. The file is memory-mapped and the tree is built in
+	 * linear time from its sorted records. Return "false", leaving
+	 * the library unchanged, if the file cannot be read or is not
+	 * a valid snapshot of this version.
+	 */
+	bool restore(const std::string&);
 	/*
 	 * Return the "total" field of an object of type Book.
 	 * If the Book is not in the library, return 0.
 	 */
-	int total(Book&) const;
+	int total(const Book&) const;
 	/*
 	 * Return "true" if the Book is in the library,
 	 * "false" otherwise.
 	 */
 	bool contains(const Book&) const;
 	/*
-	 * Search for a Book with the "isbn" field. Return
-	 * the Book if it is in the library, if not,
+	 * Search for a Book with the "isbn" field in O(log n).
+	 * Return the Book if it is in the library, if not,
 	 * return an empty Book (default constructor of
-	 * the Book class).
+	 * the Book class). The reference stays valid until the
+	 * library is modified.
+	 */
+	const Book& find(unsigned long) const;
+	/*
+	 * Return a read-only copy of the catalog laid out for fast
+	 * lookups: freeze().lookup(isbn) gives the same answers as
+	 * find, as long as the library is not modified.
+	 */
+	FrozenTree<Book> freeze() const;
+	/*
+	 * Batched lookups by ISBN: results[i] receives the answer for
+	 * isbns[i] (NULL or false if absent). The lookups are
+	 * interleaved to overlap their cache misses.
 	 */
-	Book find(unsigned long) const;
+	void find_batch(const unsigned long* isbns, size_t count, const Book** results) const;
+	void contains_batch(const unsigned long* isbns, size_t count, bool* results) const;
+	/*
+	 * ISBN pagination, each in O(log n):
+	 * 		rank		number of books with a smaller ISBN
+	 * 		select		k-th book by ISBN (from 0), or an empty Book
+	 * 				if k is out of range
+	 * 		count_range	number of books with low <= ISBN <= high
+	 */
+	int rank(unsigned long) const;
+	const Book& select(int) const;
+	int count_range(unsigned long, unsigned long) const;
+	/*
+	 * ISBN range scans. Each one is positioned in O(log n), then
+	 * walks the books in ISBN order without searching again:
+	 * 		lower_bound	first book with an ISBN >= the one passed
+	 * 		upper_bound	first book with an ISBN > the one passed
+	 * 		equal_range	both of them
+	 * 		range		books with low <= ISBN <= high
+	 * 		isbn_prefix	books whose 13-digit ISBN starts with the
+	 * 				digits passed, e.g. 9780316 for 978-0-316
+	 * An iterator past the last book converts to "false". The
+	 * iterators stay valid until the library is modified.
+	 */
+	typedef AVLTree<Book>::Iterator Iterator;
+	typedef AVLTree<Book>::Range Range;
+	Iterator lower_bound(unsigned long) const;
+	Iterator upper_bound(unsigned long) const;
+	std::pair<Iterator, Iterator> equal_range(unsigned long) const;
+	Range range(unsigned long, unsigned long) const;
+	Range isbn_prefix(unsigned long) const;
+	/*
+	 * Secondary indexes on the author and on the title, off by
+	 * default. set_indexes takes a combination of the flags below:
+	 * an index that gets enabled is built in O(n log n), then kept
+	 * up to date by insert, remove, merge, load and restore.
+	 */
+	enum { AUTHOR_INDEX = 1, TITLE_INDEX = 2 };
+	void set_indexes(int);
+	int indexes() const;
+	/*
+	 * Books of an author, by ISBN, and books whose title starts with
+	 * a prefix, by title (at most "limit" of them). Each takes
+	 * O(log n + k) with the matching index, otherwise the whole
+	 * catalog is scanned. The pointers stay valid until the library
+	 * is modified.
+	 */
+	std::vector<const Book*> by_author(std::string_view) const;
+	std::vector<const Book*> by_title_prefix(std::string_view, size_t limit = SIZE_MAX) const;
+	/*
+	 * Inventory reports computed on "threads" threads (0: one per
+	 * core), over disjoint parts of the catalog:
+	 * 		total_copies	sum of the "total" fields of every book
+	 * 		total_copies_if	same, over the books such that keep(book)
+	 * 		count_if	number of books such that keep(book)
+	 * "keep" is called concurrently and must be thread-safe.
+	 */
+	long long total_copies(unsigned threads = 0) const;
+	template <class Predicate>
+	long long total_copies_if(Predicate keep, unsigned threads = 0) const;
+	template <class Predicate>
+	int count_if(Predicate keep, unsigned threads = 0) const;
+	/*
+	 * Operation counters of the catalog tree (see treestats.h), all
+	 * zero unless the program is built with AVL_STATISTICS. A copy
+	 * of the library counts on the shared tree until it modifies it.
+	 */
+	TreeStats statistics() const;
+	void reset_statistics();
+	/*
+	 * Bytes used by the catalog tree and its indexes. The author and
+	 * title strings live in the text storage of the library, shared
+	 * with its copies, and are reported as "shared". Runs in O(blocks of the node pools),
+	 * cheap enough to be polled. Libraries sharing a tree each
+	 * report all of it.
+	 */
+	MemoryUsage memory_usage() const;
 	/*
 	 * Merge 2 libraries by inserting the books of the
 	 * library received as a parameter into the current library.
+	 * Books already present get their "total" field increased,
+	 * as with insert. The catalogs are merged with a join-based
+	 * union on several threads instead of one insert per book.
 	 */
 	void merge(Library&);
 	/*
 	 * Return "true" if the current library has exactly
 	 * the same books (based on the "==" operator of the
 	 * Book class) as the library received as a parameter.
+	 * Both catalogs are walked in ISBN order together, in
+	 * O(min(m,n)), stopping at the first difference.
 	 */
 	bool operator == (const Library& other) const;
 
 
 private:
-	AVLTree<Book> lib;
+	std::shared_ptr<AVLTree<Book> > lib;
+	/*
+	 * Enabled secondary indexes, NULL otherwise. Their entries point
+	 * into "lib", so they are shared and copied along with it.
+	 */
+	std::shared_ptr<BookIndex> authors;
+	std::shared_ptr<BookIndex> titles;
+	/*
+	 * Storage of the authors and titles of the books of "lib". It
+	 * is shared with the copies of the library, even once they own
+	 * their tree, and replaced along with the tree when a catalog
+	 * is loaded into an empty library or restored.
+	 */
+	TextRef<TextArena> text;
+	/*
+	 * Return the tree of the library, copying it first if it is
+	 * shared with another library. Called before any modification.
+	 * The indexes of a copied tree are rebuilt to point into it.
+	 */
+	AVLTree<Book>& own();
+	/*
+	 * Add or remove the index entries of a record of the tree (if
+	 * not NULL). index also re-points existing entries at the record.
+	 */
+	bool indexed() const;
+	void index(const Book*);
+	void unindex(const Book*);
+	/*
+	 * Rebuild the enabled indexes from the tree, after it is copied
+	 * or rebuilt. makeIndex returns a new index of the books of a
+	 * tree on one of their fields.
+	 */
+	void reindex();
+	static std::shared_ptr<BookIndex> makeIndex(const AVLTree<Book>&, Text Book::*);
+	/*
+	 * Union of the tree of the library with another tree, adding up
+	 * the copies of equal ISBNs, keeping the indexes up to date. The
+	 * nodes of the other tree are moved into the library.
+	 */
+	void unite(AVLTree<Book>&&, unsigned threads);
+	/*
+	 * Return a copy of a Book with its text in the storage of the
+	 * library, written by "writer" (the arena or a Writer of it).
+	 * The strings of the record with the same ISBN (if not NULL) are
+	 * reused when they are equal, so inserting or merging a book
+	 * already present does not store its title again.
+	 */
+	template <class Writer>
+	Book adopt(const Book&, const Book* record, Writer& writer);
+	/*
+	 * Insert a Book whose text is already in the storage of the
+	 * library into the tree it owns, keeping the indexes up to date.
+	 */
+	void place(Book&&);
+	/*
+	 * Empty Book returned by reference when a search fails.
+	 */
+	static const Book& none();
 	/**** You can add any private function you need ***********/
 /**** Don't forget to explain its functionality in a comment ****/
 };
 
-Library::Library() {
+Library::Library() : lib(std::make_shared<AVLTree<Book> >()), text(TextRef<TextArena>(new TextArena())) {
 }
 
 Library::~Library() {
 }
 
+Library::Library(const Library& other) : lib(other.lib), authors(other.authors), titles(other.titles), text(other.text) {
+}
+
+Library::Library(Library&& other) : lib(std::make_shared<AVLTree<Book> >()), text(TextRef<TextArena>(new TextArena())) {
+	swap(other);
+}
+
 Library& Library::operator = (const Library& other) {
 	lib = other.lib;
+	authors = other.authors;
+	titles = other.titles;
+	text = other.text;
 	return *this;
 }
 
+Library& Library::operator = (Library&& other) {
+	if (this != &other) {
+		lib = std::move(other.lib);
+		authors = std::move(other.authors);
+		titles = std::move(other.titles);
+		text = std::move(other.text);
+		other.lib = std::make_shared<AVLTree<Book> >();
+		other.text = TextRef<TextArena>(new TextArena());
+	}
+	return *this;
+}
+
+void Library::swap(Library& other) {
+	lib.swap(other.lib);
+	authors.swap(other.authors);
+	titles.swap(other.titles);
+	std::swap(text, other.text);
+}
+
 void Library::insert(Book& b) {
-	lib.insert(b);
+	insert(Book(b));
 }
 
-bool Library::contains(const Book& b) const {
-	return lib.contains(b);
+void Library::insert(Book&& b) {
+	AVLTree<Book>& books = own();
+	place(adopt(b, books.lookup(b.isbn), *text));
 }
 
-int Library::total(Book& b) const {
-	if (contains(b)) {
-		Book found;
-		for (AVLTree<Book>::Iterator iter = lib.begin(); iter; ++iter) {
-			if (lib[iter] == b) {
-				found = lib[iter];
-				break;
-			}
+void Library::remove(const Book& b) {
+	AVLTree<Book>& books = own();
+	if (!indexed()) {
+		books.remove(b);
+		return;
+	}
+	unindex(books.lookup(b.isbn));
+	books.remove(b);
+}
+
+int Library::erase_range(unsigned long low, unsigned long high) {
+	AVLTree<Book>& books = own();
+	if (indexed()) {
+		for (const Book& b : books.range(low, high))
+			unindex(&b);
+	}
+	return books.erase_range(Book(low), Book(high));
+}
+
+template <class Predicate>
+int Library::retain_if(Predicate keep) {
+	AVLTree<Book>& books = own();
+	return books.retain_if([&](const Book& b) {
+		if (keep(b))
+			return true;
+		unindex(&b);
+		return false;
+	});
+}
+
+void Library::load(std::istream& in, std::vector<CatalogError>& errors) {
+	TextRef<TextArena> storage = lib->isEmpty() ? TextRef<TextArena>(new TextArena()) : text;
+	TextArena::Writer writer(*storage);
+	std::vector<Book> books;
+	std::string line;
+	for (size_t number = 1; std::getline(in, line); number++) {
+		parseCatalog(line.data(), line.data() + line.size(), writer, [&books](Book&& b) {
+			books.push_back(std::move(b));
+		}, errors, number);
+	}
+	if (lib->isEmpty()) {
+		lib = std::make_shared<AVLTree<Book> >();
+		text = storage;
+		lib->build(std::make_move_iterator(books.begin()), std::make_move_iterator(books.end()));
+		reindex();
+	}
+	else {
+		own();
+		for (Book& b : books)
+			place(std::move(b));
+	}
+}
+
+bool Library::load(const std::string& path, std::vector<CatalogError>& errors, unsigned threads, LoadTimings* timings) {
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	ThreadPool workers(threads);
+	size_t count = file.size() < (1 << 20) ? 1 : 4 * workers.size();
+	std::vector<const char*> bounds = splitCatalog(file.data(), file.data() + file.size(), count);
+	Clock::time_point mapped = Clock::now();
+
+	TextRef<TextArena> storage = lib->isEmpty() ? TextRef<TextArena>(new TextArena()) : text;
+	std::vector<CatalogChunk> chunks(count);
+	for (size_t i = 0; i < count; i++) {
+		CatalogChunk* chunk = &chunks[i];
+		TextArena* arena = storage.get();
+		const char* begin = bounds[i];
+		const char* end = bounds[i + 1];
+		workers.submit([chunk, arena, begin, end]() {
+			parseChunk(begin, end, *chunk, *arena);
+		});
+	}
+	workers.wait();
+	size_t firstLine = 0;
+	for (size_t i = 0; i < count; i++) {
+		for (CatalogError& e : chunks[i].errors) {
+			e.line += firstLine;
+			errors.push_back(std::move(e));
 		}
-		return found.copies();
+		firstLine += chunks[i].lines;
+	}
+	Clock::time_point parsed = Clock::now();
+
+	std::vector<Book> books;
+	mergeChunks(chunks, books);
+	chunks.clear();
+	Clock::time_point merged = Clock::now();
+
+	if (lib->isEmpty()) {
+		lib = std::make_shared<AVLTree<Book> >();
+		text = storage;
+		lib->build(std::make_move_iterator(books.begin()), std::make_move_iterator(books.end()));
+		reindex();
+	}
+	else {
+		AVLTree<Book> loaded;
+		loaded.build(std::make_move_iterator(books.begin()), std::make_move_iterator(books.end()));
+		unite(std::move(loaded), workers.size());
 	}
-	else
+	Clock::time_point built = Clock::now();
+
+	if (timings != nullptr) {
+		timings->map = std::chrono::duration<double>(mapped - start).count();
+		timings->parse = std::chrono::duration<double>(parsed - mapped).count();
+		timings->merge = std::chrono::duration<double>(merged - parsed).count();
+		timings->build = std::chrono::duration<double>(built - merged).count();
+	}
+	return true;
+}
+
+bool Library::save(const std::string& path) const {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+	SnapshotHeader header;
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.recordSize = sizeof(SnapshotRecord);
+	header.count = 0;
+	header.heapSize = 0;
+	header.recordsChecksum = 0;
+	header.heapChecksum = 0;
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	Checksum records;
+	for (const Book& b : *lib) {
+		SnapshotRecord record;
+		record.isbn = b.isbn;
+		record.offset = header.heapSize;
+		record.authorLength = (uint32_t)b.author.size();
+		record.titleLength = (uint32_t)b.title.size();
+		record.total = b.total;
+		record.reserved = 0;
+		records.add(&record, sizeof(record));
+		out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		header.count++;
+		header.heapSize += record.authorLength + record.titleLength;
+	}
+	Checksum heap;
+	for (const Book& b : *lib) {
+		heap.add(b.author.data(), b.author.size());
+		heap.add(b.title.data(), b.title.size());
+		out.write(b.author.data(), b.author.size());
+		out.write(b.title.data(), b.title.size());
+	}
+	header.recordsChecksum = records.value();
+	header.heapChecksum = heap.value();
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	return (bool)out;
+}
+
+bool Library::restore(const std::string& path) {
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(SnapshotHeader))
+		return false;
+	SnapshotHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != SNAPSHOT_VERSION ||
+		header.recordSize != sizeof(SnapshotRecord) ||
+		header.count > (file.size() - sizeof(header)) / sizeof(SnapshotRecord) ||
+		header.heapSize != file.size() - sizeof(header) - header.count * sizeof(SnapshotRecord))
+		return false;
+	const char* recordBytes = file.data() + sizeof(header);
+	const char* heap = recordBytes + header.count * sizeof(SnapshotRecord);
+	Checksum recordsChecksum;
+	recordsChecksum.add(recordBytes, header.count * sizeof(SnapshotRecord));
+	Checksum heapChecksum;
+	heapChecksum.add(heap, header.heapSize);
+	if (recordsChecksum.value() != header.recordsChecksum || heapChecksum.value() != header.heapChecksum)
+		return false;
+
+	TextRef<TextArena> storage = TextRef<TextArena>(new TextArena());
+	TextArena::Writer writer(*storage);
+	std::vector<Book> books;
+	books.reserve(header.count);
+	for (uint64_t i = 0; i < header.count; i++) {
+		SnapshotRecord record;
+		std::memcpy(&record, recordBytes + i * sizeof(SnapshotRecord), sizeof(record));
+		if (record.offset > header.heapSize ||
+			(uint64_t)record.authorLength + record.titleLength > header.heapSize - record.offset)
+			return false;
+		const char* author = heap + record.offset;
+		books.push_back(Book(record.isbn,
+			writer.intern(std::string_view(author, record.authorLength)),
+			writer.store(std::string_view(author + record.authorLength, record.titleLength)),
+			record.total, writer.reference()));
+	}
+	lib = std::make_shared<AVLTree<Book> >();
+	text = storage;
+	lib->build(std::make_move_iterator(books.begin()), std::make_move_iterator(books.end()));
+	reindex();
+	return true;
+}
+
+bool Library::contains(const Book& b) const {
+	return lib->contains(b);
+}
+
+int Library::total(const Book& b) const {
+	const Book* found = lib->lookup(b);
+	if (found == nullptr)
 		return 0;
+	return found->copies();
+}
+
+const Book& Library::find(unsigned long isbn) const {
+	const Book* found = lib->lookup(isbn);
+	if (found == nullptr)
+		return none();
+	return *found;
+}
+
+FrozenTree<Book> Library::freeze() const {
+	return lib->freeze();
+}
+
+void Library::find_batch(const unsigned long* isbns, size_t count, const Book** results) const {
+	lib->find_batch(isbns, count, results);
+}
+
+void Library::contains_batch(const unsigned long* isbns, size_t count, bool* results) const {
+	lib->contains_batch(isbns, count, results);
+}
+
+int Library::rank(unsigned long isbn) const {
+	return lib->rank(Book(isbn));
+}
+
+const Book& Library::select(int k) const {
+	const Book* found = lib->select(k);
+	if (found == nullptr)
+		return none();
+	return *found;
+}
+
+int Library::count_range(unsigned long low, unsigned long high) const {
+	return lib->count_range(Book(low), Book(high));
+}
+
+Library::Iterator Library::lower_bound(unsigned long isbn) const {
+	return lib->lower_bound(isbn);
+}
+
+Library::Iterator Library::upper_bound(unsigned long isbn) const {
+	return lib->upper_bound(isbn);
+}
+
+std::pair<Library::Iterator, Library::Iterator> Library::equal_range(unsigned long isbn) const {
+	return lib->equal_range(isbn);
+}
+
+Library::Range Library::range(unsigned long low, unsigned long high) const {
+	return lib->range(low, high);
+}
+
+Library::Range Library::isbn_prefix(unsigned long prefix) const {
+	/* Pad the prefix with zeros up to 13 digits */
+	unsigned long long low = prefix;
+	unsigned long long width = 1;
+	while (low != 0 && low < 1000000000000ULL) {
+		low *= 10;
+		width *= 10;
+	}
+	return lib->range((unsigned long)low, (unsigned long)(low + width - 1));
+}
+
+void Library::set_indexes(int kinds) {
+	if ((kinds & AUTHOR_INDEX) == 0)
+		authors.reset();
+	else if (authors == nullptr)
+		authors = makeIndex(*lib, &Book::author);
+	if ((kinds & TITLE_INDEX) == 0)
+		titles.reset();
+	else if (titles == nullptr)
+		titles = makeIndex(*lib, &Book::title);
+}
+
+int Library::indexes() const {
+	return (authors != nullptr ? AUTHOR_INDEX : 0) | (titles != nullptr ? TITLE_INDEX : 0);
+}
+
+std::vector<const Book*> Library::by_author(std::string_view author) const {
+	std::vector<const Book*> found;
+	if (authors != nullptr) {
+		authors->equal(author, [&](const Book* b) {
+			found.push_back(b);
+		});
+	}
+	else {
+		for (const Book& b : *lib) {
+			if (b.author.view() == author)
+				found.push_back(&b);
+		}
+	}
+	return found;
+}
+
+std::vector<const Book*> Library::by_title_prefix(std::string_view prefix, size_t limit) const {
+	std::vector<const Book*> found;
+	if (titles != nullptr) {
+		titles->prefix(prefix, limit, [&](const Book* b) {
+			found.push_back(b);
+		});
+		return found;
+	}
+	for (const Book& b : *lib) {
+		if (b.title.view().substr(0, prefix.size()) == prefix)
+			found.push_back(&b);
+	}
+	std::stable_sort(found.begin(), found.end(), [](const Book* b1, const Book* b2) {
+		return b1->title.view() < b2->title.view();
+	});
+	if (found.size() > limit)
+		found.resize(limit);
+	return found;
+}
+
+long long Library::total_copies(unsigned threads) const {
+	return total_copies_if([](const Book&) { return true; }, threads);
+}
+
+template <class Predicate>
+long long Library::total_copies_if(Predicate keep, unsigned threads) const {
+	return lib->parallel_transform_reduce(0LL, [&](const Book& b) {
+		return keep(b) ? (long long)b.total : 0LL;
+	}, [](long long a, long long b) { return a + b; }, threads);
+}
+
+template <class Predicate>
+int Library::count_if(Predicate keep, unsigned threads) const {
+	return lib->parallel_count_if(keep, threads);
 }
 
-Book Library::find(unsigned long b) const {
-	Book book;
-	Book toFind(b);
-	for (AVLTree<Book>::Iterator iter = lib.begin(); iter; ++iter) {
-		Book found = lib[iter];
-		if (found == toFind)
-			return found;
+TreeStats Library::statistics() const {
+	return lib->statistics();
+}
+
+void Library::reset_statistics() {
+	lib->reset_statistics();
+}
+
+MemoryUsage Library::memory_usage() const {
+	MemoryUsage usage = lib->memory_usage();
+	const BookIndex* indexes[] = { authors.get(), titles.get() };
+	for (const BookIndex* index : indexes) {
+		if (index != nullptr) {
+			MemoryUsage entries = index->memory_usage();
+			usage.indexes += entries.nodes + entries.slack;
+		}
 	}
-	return book;
+	usage.shared = text->reserved();
+	return usage;
 }
 
 void Library::merge(Library& bib) {
-	for (AVLTree<Book>::Iterator iter2 = bib.lib.begin(); iter2; ++iter2) {
-		insert(bib.lib[iter2]);
+	if (bib.text.get() == text.get()) {
+		unite(AVLTree<Book>(*bib.lib), 0);
+		return;
 	}
+	/* Copy the text of the other catalog into this library first */
+	TextArena::Writer writer(*text);
+	std::vector<Book> books;
+	books.reserve(bib.lib->size());
+	for (const Book& b : *bib.lib)
+		books.push_back(adopt(b, lib->lookup(b.isbn), writer));
+	AVLTree<Book> adopted;
+	adopted.build(std::make_move_iterator(books.begin()), std::make_move_iterator(books.end()));
+	unite(std::move(adopted), 0);
 }
 
 bool Library::operator == (const Library& other) const {
-	return lib == other.lib;
+	return *lib == *other.lib;
+}
+
+AVLTree<Book>& Library::own() {
+	if (lib.use_count() > 1) {
+		lib = std::make_shared<AVLTree<Book> >(*lib);
+		reindex();
+	}
+	return *lib;
+}
+
+bool Library::indexed() const {
+	return authors != nullptr || titles != nullptr;
+}
+
+void Library::index(const Book* record) {
+	if (record == nullptr)
+		return;
+	if (authors != nullptr)
+		authors->add(record->author, record->isbn, record);
+	if (titles != nullptr)
+		titles->add(record->title, record->isbn, record);
+}
+
+void Library::unindex(const Book* record) {
+	if (record == nullptr)
+		return;
+	if (authors != nullptr)
+		authors->remove(record->author, record->isbn);
+	if (titles != nullptr)
+		titles->remove(record->title, record->isbn);
+}
+
+void Library::reindex() {
+	if (authors != nullptr)
+		authors = makeIndex(*lib, &Book::author);
+	if (titles != nullptr)
+		titles = makeIndex(*lib, &Book::title);
+}
+
+std::shared_ptr<BookIndex> Library::makeIndex(const AVLTree<Book>& books, Text Book::* field) {
+	std::vector<IndexEntry> entries;
+	for (const Book& b : books)
+		entries.push_back(IndexEntry{ b.*field, b.isbn, &b });
+	std::shared_ptr<BookIndex> index = std::make_shared<BookIndex>();
+	index->build(entries);
+	return index;
+}
+
+void Library::unite(AVLTree<Book>&& other, unsigned threads) {
+	AVLTree<Book>& books = own();
+	std::vector<unsigned long> isbns;
+	if (indexed()) {
+		isbns.reserve(other.size());
+		for (const Book& b : other) {
+			unindex(books.lookup(b.isbn));
+			isbns.push_back(b.isbn);
+		}
+	}
+	books.union_with(std::move(other), [](Book& mine, Book& theirs) {
+		mine = std::move(theirs);
+	}, threads);
+	for (size_t i = 0; i < isbns.size(); i++)
+		index(books.lookup(isbns[i]));
+}
+
+template <class Writer>
+Book Library::adopt(const Book& b, const Book* record, Writer& writer) {
+	Text author = record != nullptr && record->author.view() == b.author.view() ? record->author : writer.intern(b.author.view());
+	Text title = record != nullptr && record->title.view() == b.title.view() ? record->title : writer.store(b.title.view());
+	return Book(b.isbn, author, title, b.total, writer.reference());
+}
+
+void Library::place(Book&& b) {
+	if (!indexed()) {
+		lib->insert(std::move(b));
+		return;
+	}
+	unsigned long isbn = b.isbn;
+	unindex(lib->lookup(isbn));
+	lib->insert(std::move(b));
+	index(lib->lookup(isbn));
+}
+
+const Book& Library::none() {
+	static const Book empty;
+	return empty;
 }
 
 #endif
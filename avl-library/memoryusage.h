@@ -0,0 +1,79 @@
+/*
+ * Memory accounting of the containers.
+ *
+ * HeapUsage<T> tells how much heap memory an element owns besides its
+ * own bytes. The default owns none. A type that owns memory specializes
+ * it with owns_heap = true and a bytes() function: the containers then
+ * walk their elements to add it up, otherwise they only add up the
+ * blocks of their node pools.
+ */
+
+#ifndef __MEMORYUSAGE_H__
+#define __MEMORYUSAGE_H__
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+template <class T>
+struct HeapUsage {
+	static const bool owns_heap = false;
+	static size_t bytes(const T&) {
+		return 0;
+	}
+};
+
+/*
+ * Characters beyond the small string buffer are on the heap.
+ */
+template <>
+struct HeapUsage<std::string> {
+	static const bool owns_heap = true;
+	static size_t bytes(const std::string& s) {
+		return s.capacity() >= sizeof(std::string) ? s.capacity() + 1 : 0;
+	}
+};
+
+/*
+ * What a container costs, in bytes:
+ * 		nodes		one node per element, the elements included
+ * 		payload		heap owned by the elements (see HeapUsage)
+ * 		slack		storage reserved by the node allocator that does
+ * 				not hold a node
+ * 		indexes		secondary structures (nodes and slack)
+ * 		shared		storage shared with other containers, such as the
+ * 				text storage of the Books, not part of total()
+ * 		iterator	size of one iterator, which lives on the stack of
+ * 				its user and allocates nothing
+ */
+struct MemoryUsage {
+	size_t elements;
+	size_t nodes;
+	size_t payload;
+	size_t slack;
+	size_t indexes;
+	size_t shared;
+	size_t iterator;
+
+	size_t total() const;
+	double perElement() const;
+};
+
+std::ostream& operator << (std::ostream&, const MemoryUsage&);
+
+size_t MemoryUsage::total() const {
+	return nodes + payload + slack + indexes;
+}
+
+double MemoryUsage::perElement() const {
+	return elements != 0 ? (double)total() / elements : 0;
+}
+
+std::ostream& operator << (std::ostream& os, const MemoryUsage& usage) {
+	return os << usage.elements << " elements: " << usage.nodes << " node bytes, "
+		<< usage.payload << " payload bytes, " << usage.slack << " slack bytes, "
+		<< usage.indexes << " index bytes (" << usage.perElement() << " per element), "
+		<< usage.shared << " shared bytes";
+}
+
+#endif
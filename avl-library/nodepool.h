@@ -0,0 +1,200 @@
+/*
+ * Node allocation policies for the AVLTree class.
+ *
+ * A policy is a class template Pool<N> giving raw storage for objects of
+ * type N. The tree constructs and destroys the nodes itself.
+ *
+ * 		N* allocate()			storage for one node
+ * 		void deallocate(N*)		give back the storage of one node
+ * 		void release()			give back every node at once
+ * 		void swap(Pool&)		exchange the storage of two pools
+ * 		void share(const Pool&)		keep alive the storage of the nodes of
+ * 						another pool, so that they can be moved
+ * 						into a tree using this pool
+ * 		size_t reserved() const		bytes of storage held by the pool, free
+ * 						or not (0 if it holds none itself)
+ * 		owns_nodes			true if release() really frees every node
+ */
+
+#ifndef __NODEPOOL_H__
+#define __NODEPOOL_H__
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ * Slab allocator: nodes are carved out of contiguous blocks whose size
+ * doubles up to a maximum, freed nodes are recycled through a free list
+ * and release() gives back all the blocks in O(blocks).
+ * Blocks are reference counted, so that pools sharing them (after a
+ * split or a join between trees) free a block only once no pool uses it.
+ */
+template <class N>
+class NodePool {
+public:
+	static const bool owns_nodes = true;
+
+	NodePool();
+	~NodePool();
+
+	N* allocate();
+	void deallocate(N*);
+	void release();
+	void share(const NodePool&);
+	void swap(NodePool&);
+	/*
+	 * Blocks shared with other pools are counted by each of them.
+	 */
+	size_t reserved() const;
+
+private:
+	NodePool(const NodePool&);
+	NodePool& operator = (const NodePool&);
+
+	union Slot {
+		Slot* next;
+		alignas(N) unsigned char storage[sizeof(N)];
+	};
+	static const size_t FIRST_BLOCK = 32;
+	static const size_t LAST_BLOCK = 65536;
+
+	static void freeBlock(Slot*);
+
+	/*
+	 * The blocks and their number of slots.
+	 */
+	std::vector<std::pair<std::shared_ptr<Slot>, size_t> > blocks;
+	Slot* freeList;
+	Slot* cursor;
+	Slot* blockEnd;
+	size_t nextBlock;
+};
+
+/*
+ * Plain allocator: one call to operator new per node, as the tree
+ * originally did. release() cannot free the nodes by itself.
+ */
+template <class N>
+class HeapPool {
+public:
+	static const bool owns_nodes = false;
+
+	N* allocate();
+	void deallocate(N*);
+	void release();
+	void share(const HeapPool&);
+	void swap(HeapPool&);
+	size_t reserved() const;
+};
+
+/************ NodePool ***************/
+
+template <class N>
+NodePool<N>::NodePool() : freeList(nullptr), cursor(nullptr), blockEnd(nullptr), nextBlock(FIRST_BLOCK) {
+}
+
+template <class N>
+NodePool<N>::~NodePool() {
+	release();
+}
+
+template <class N>
+N* NodePool<N>::allocate() {
+	Slot* slot;
+	if (freeList != nullptr) {
+		slot = freeList;
+		freeList = freeList->next;
+	}
+	else {
+		if (cursor == blockEnd) {
+			cursor = static_cast<Slot*>(::operator new(nextBlock * sizeof(Slot)));
+			blocks.push_back(std::make_pair(std::shared_ptr<Slot>(cursor, freeBlock), nextBlock));
+			blockEnd = cursor + nextBlock;
+			if (nextBlock < LAST_BLOCK)
+				nextBlock *= 2;
+		}
+		slot = cursor++;
+	}
+	return reinterpret_cast<N*>(slot->storage);
+}
+
+template <class N>
+void NodePool<N>::deallocate(N* n) {
+	Slot* slot = reinterpret_cast<Slot*>(n);
+	slot->next = freeList;
+	freeList = slot;
+}
+
+template <class N>
+void NodePool<N>::release() {
+	blocks.clear();
+	freeList = nullptr;
+	cursor = nullptr;
+	blockEnd = nullptr;
+	nextBlock = FIRST_BLOCK;
+}
+
+template <class N>
+void NodePool<N>::share(const NodePool& other) {
+	if (this == &other)
+		return;
+	blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+	std::sort(blocks.begin(), blocks.end());
+	blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+}
+
+template <class N>
+void NodePool<N>::swap(NodePool& other) {
+	blocks.swap(other.blocks);
+	std::swap(freeList, other.freeList);
+	std::swap(cursor, other.cursor);
+	std::swap(blockEnd, other.blockEnd);
+	std::swap(nextBlock, other.nextBlock);
+}
+
+template <class N>
+size_t NodePool<N>::reserved() const {
+	size_t slots = 0;
+	for (size_t i = 0; i < blocks.size(); i++)
+		slots += blocks[i].second;
+	return slots * sizeof(Slot);
+}
+
+template <class N>
+void NodePool<N>::freeBlock(Slot* block) {
+	::operator delete(block);
+}
+
+/************ HeapPool ***************/
+
+template <class N>
+N* HeapPool<N>::allocate() {
+	return static_cast<N*>(::operator new(sizeof(N)));
+}
+
+template <class N>
+void HeapPool<N>::deallocate(N* n) {
+	::operator delete(n);
+}
+
+template <class N>
+void HeapPool<N>::release() {
+}
+
+template <class N>
+void HeapPool<N>::share(const HeapPool&) {
+}
+
+template <class N>
+void HeapPool<N>::swap(HeapPool&) {
+}
+
+template <class N>
+size_t HeapPool<N>::reserved() const {
+	return 0;
+}
+
+#endif
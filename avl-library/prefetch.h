@@ -0,0 +1,17 @@
+/*
+ * Software prefetch hint, a no-op where the compiler has none.
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVL_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define AVL_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define AVL_PREFETCH(address) ((void)(address))
+#endif
+
+#endif
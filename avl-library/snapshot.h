@@ -0,0 +1,100 @@
+/*
+ * Binary snapshot format of a Library.
+ *
+ * 		SnapshotHeader
+ * 		SnapshotRecord[count]		in increasing ISBN order
+ * 		char heap[heapSize]		author then title of each record
+ *
+ * Integers are stored in the byte order of the machine that wrote the
+ * snapshot. The records and the heap are covered by separate checksums.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdint>
+#include <cstring>
+
+static const char SNAPSHOT_MAGIC[8] = { 'A', 'V', 'L', 'L', 'I', 'B', '\r', '\n' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    uint64_t heapSize;
+    uint64_t recordsChecksum;
+    uint64_t heapChecksum;
+};
+
+struct SnapshotRecord {
+    uint64_t isbn;
+    uint64_t offset;
+    uint32_t authorLength;
+    uint32_t titleLength;
+    int32_t total;
+    uint32_t reserved;
+};
+
+/*
+ * Streaming 64-bit checksum. Bytes are mixed 8 at a time, so the value
+ * only depends on the sequence of bytes, not on how it was split.
+ */
+class Checksum {
+public:
+    Checksum();
+    void add(const void*, size_t);
+    uint64_t value() const;
+
+private:
+    static uint64_t mix(uint64_t, uint64_t);
+
+    uint64_t hash;
+    uint64_t length;
+    unsigned char pending[8];
+    size_t pendingBytes;
+};
+
+Checksum::Checksum() : hash(0x84222325CBF29CE4ULL), length(0), pendingBytes(0) {
+}
+
+uint64_t Checksum::mix(uint64_t h, uint64_t word) {
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+void Checksum::add(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    length += size;
+    if (pendingBytes != 0) {
+        size_t taken = size < 8 - pendingBytes ? size : 8 - pendingBytes;
+        std::memcpy(pending + pendingBytes, bytes, taken);
+        pendingBytes += taken;
+        bytes += taken;
+        size -= taken;
+        if (pendingBytes == 8) {
+            uint64_t word;
+            std::memcpy(&word, pending, 8);
+            hash = mix(hash, word);
+            pendingBytes = 0;
+        }
+    }
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        hash = mix(hash, word);
+    }
+    if (size > 0) {
+        std::memcpy(pending, bytes, size);
+        pendingBytes = size;
+    }
+}
+
+uint64_t Checksum::value() const {
+    uint64_t word = 0;
+    std::memcpy(&word, pending, pendingBytes);
+    return mix(mix(hash, word), length);
+}
+
+#endif
@@ -6,23 +6,29 @@
 #ifndef __STACK_H__
 #define __STACK_H__
 
+#include <utility>
+
 template <class T>
 class Stack {
 public:
     Stack();
     Stack(Stack<T>& other);
+    Stack(Stack<T>&& other);
     ~Stack();
 
     void push(const T&);
+    void push(T&&);
     T pop();
     bool empty() const;
     void clear();
     Stack<T>& operator = (const Stack<T>& other);
+    Stack<T>& operator = (Stack<T>&& other);
 
 private:
     class Cell {
     public:
         Cell(const T& e, Cell* n);
+        Cell(T&& e, Cell* n);
         T content;
         Cell* next;
     };
@@ -54,6 +60,12 @@ Stack<T>::Stack(Stack<T>& other) {
         top = nullptr;
 }
 
+template <class T>
+Stack<T>::Stack(Stack<T>&& other) {
+    top = other.top;
+    other.top = nullptr;
+}
+
 template <class T>
 Stack<T>::~Stack() {
     clear();
@@ -66,8 +78,11 @@ void Stack<T>::clear() {
 }
 
 template <class T>
-Stack<T>::Cell::Cell(const T& e, Cell* n) : next(n) {
-    content = e;
+Stack<T>::Cell::Cell(const T& e, Cell* n) : content(e), next(n) {
+}
+
+template <class T>
+Stack<T>::Cell::Cell(T&& e, Cell* n) : content(std::move(e)), next(n) {
 }
 
 template <class T>
@@ -76,13 +91,24 @@ void Stack<T>::push(const T& e) {
     assert(top);
 }
 
+template <class T>
+void Stack<T>::push(T&& e) {
+    top = new Cell(std::move(e), top);
+    assert(top);
+}
+
+/*
+ * Unlinks the top cell and moves its content out, without copying
+ * the cell.
+ */
 template <class T>
 T Stack<T>::pop() {
     assert(top);
-    Cell c(*top);
-    delete top;
-    top = c.next;
-    return c.content;
+    Cell* c = top;
+    top = c->next;
+    T e(std::move(c->content));
+    delete c;
+    return e;
 }
 
 template <class T>
@@ -111,4 +137,15 @@ Stack<T>& Stack<T>::operator = (const Stack<T>& other) {
     return *this;
 }
 
+template <class T>
+Stack<T>& Stack<T>::operator = (Stack<T>&& other) {
+    if (this == &other)
+        return *this;
+
+    clear();
+    top = other.top;
+    other.top = nullptr;
+    return *this;
+}
+
 #endif
@@ -0,0 +1,499 @@
+/*
+ * Text storage for the strings of Book.
+ *
+ * A Text is a handle to characters held by a TextStorage: copying or
+ * comparing handles never touches the heap. A storage counts the
+ * references taken on it (see TextRef) and frees its characters with the
+ * last one, so a Book keeps the text it points to alive, whatever became
+ * of the library it was taken from. Two kinds of storage are available:
+ *
+ * 		TextBlock	the author and title of one Book built by a
+ * 				public constructor of Book, in one allocation
+ * 		TextArena	the strings of a whole catalog, appended to
+ * 				large chunks: authors are interned (equal
+ * 				strings share one copy, found in a hash table),
+ * 				titles are stored as they come
+ *
+ * Arenas are thread-safe. A thread appending many strings (e.g. a parsing
+ * task) can use a Writer, which fills chunks of its own and only locks
+ * the arena to get a new chunk; the intern table is split into
+ * independently locked shards.
+ */
+
+#ifndef __TEXTARENA_H__
+#define __TEXTARENA_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class Text {
+public:
+    /*
+     * The empty string, which uses no storage.
+     */
+    Text();
+
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    std::string_view view() const;
+
+private:
+    explicit Text(const char*);
+
+    /*
+     * Bytes taken in a storage by a string of the given length, and
+     * copy of a string at the start of such an area.
+     */
+    static size_t footprint(size_t length);
+    static Text write(char* area, std::string_view);
+
+    /*
+     * Points to the characters, preceded by their length on 4 bytes.
+     */
+    const char* text;
+
+    friend class TextArena;
+    friend class TextBlock;
+};
+
+std::ostream& operator << (std::ostream&, const Text&);
+
+/*
+ * Base of the objects holding characters of Texts. It is destroyed when
+ * the last reference on it is released.
+ */
+class TextStorage {
+public:
+    void retain() const;
+    void release() const;
+    /*
+     * Bytes of every storage alive.
+     */
+    static size_t live();
+
+protected:
+    TextStorage();
+    virtual ~TextStorage();
+
+    static std::atomic<size_t>& alive();
+
+    mutable std::atomic<size_t> references;
+
+private:
+    TextStorage(const TextStorage&);
+    TextStorage& operator = (const TextStorage&);
+};
+
+/*
+ * Counted reference on a storage, or on nothing.
+ */
+template <class S>
+class TextRef {
+public:
+    TextRef();
+    explicit TextRef(S*);
+    TextRef(const TextRef&);
+    TextRef(TextRef&&) noexcept;
+    ~TextRef();
+    TextRef& operator = (const TextRef&);
+    TextRef& operator = (TextRef&&) noexcept;
+
+    S* get() const;
+    S& operator * () const;
+    S* operator -> () const;
+
+private:
+    S* storage;
+
+    friend class TextArena;
+};
+
+/*
+ * Storage of the two strings of one Book.
+ */
+class TextBlock : public TextStorage {
+public:
+    /*
+     * Returns a block holding copies of both strings, with handles to
+     * them in "first" and "second", or NULL if both are empty.
+     */
+    static TextBlock* create(std::string_view, std::string_view, Text& first, Text& second);
+    static void operator delete(void*);
+
+private:
+    explicit TextBlock(size_t bytes);
+    ~TextBlock();
+
+    size_t bytes;
+};
+
+class TextArena : public TextStorage {
+public:
+    static const size_t CHUNK = 256 * 1024;
+
+    TextArena();
+    ~TextArena();
+
+    Text intern(std::string_view);
+    Text store(std::string_view);
+    /*
+     * A new reference on the arena, for a Book pointing into it.
+     */
+    TextRef<TextStorage> reference();
+    /*
+     * Bytes of the chunks of the arena.
+     */
+    size_t reserved() const;
+
+    /*
+     * Appends strings to an arena for one thread at a time. The rest of
+     * its last chunk is left unused when it is destroyed. The arena
+     * must outlive the writer.
+     */
+    class Writer {
+    public:
+        explicit Writer(TextArena&);
+        ~Writer();
+
+        Text intern(std::string_view);
+        Text store(std::string_view);
+        /*
+         * Same as TextArena::reference. The references are counted
+         * on the arena by batches of REFERENCES, so that writers on
+         * several threads do not all update the counter of the arena.
+         */
+        TextRef<TextStorage> reference();
+        static const size_t REFERENCES = 256;
+
+    private:
+        Writer(const Writer&);
+        Writer& operator = (const Writer&);
+
+        const char* append(std::string_view);
+
+        TextArena& arena;
+        char* cursor;
+        char* limit;
+        /*
+         * References counted on the arena and not handed out yet.
+         */
+        size_t reserved;
+    };
+
+private:
+    static const size_t SHARDS = 16;
+
+    /*
+     * Hash set of the interned strings, split into shards so that threads
+     * interning different strings rarely wait for each other.
+     */
+    struct Shard {
+        std::mutex lock;
+        std::unordered_set<std::string_view> strings;
+    };
+
+    /*
+     * Returns a new chunk of "length" bytes, owned by the arena.
+     */
+    char* allocate(size_t length);
+    /*
+     * Returns a reference on the storage passed, already counted.
+     */
+    static TextRef<TextStorage> counted(TextStorage*);
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<char[]> > chunks;
+    std::atomic<size_t> total;
+    Shard shards[SHARDS];
+    /*
+     * Writer of intern and store, used under "writing". It never hands
+     * out references, which would keep the arena from being freed.
+     */
+    std::mutex writing;
+    Writer writer;
+};
+
+/************ Text ***************/
+
+/*
+ * Length prefix and characters of the empty string.
+ */
+alignas(4) static const char EMPTY_TEXT[5] = { 0, 0, 0, 0, 0 };
+
+Text::Text() : text(EMPTY_TEXT + 4) {
+}
+
+Text::Text(const char* t) : text(t) {
+}
+
+const char* Text::data() const {
+    return text;
+}
+
+size_t Text::size() const {
+    uint32_t length;
+    std::memcpy(&length, text - 4, 4);
+    return length;
+}
+
+bool Text::empty() const {
+    return size() == 0;
+}
+
+std::string_view Text::view() const {
+    return std::string_view(text, size());
+}
+
+/*
+ * The length, the characters and a terminating null, rounded up to 4
+ * bytes so that the next length is aligned.
+ */
+size_t Text::footprint(size_t length) {
+    return (4 + length + 1 + 3) & ~(size_t)3;
+}
+
+Text Text::write(char* area, std::string_view s) {
+    uint32_t length = (uint32_t)s.size();
+    std::memcpy(area, &length, 4);
+    std::memcpy(area + 4, s.data(), s.size());
+    area[4 + s.size()] = '\0';
+    return Text(area + 4);
+}
+
+std::ostream& operator << (std::ostream& os, const Text& t) {
+    return os << t.view();
+}
+
+/************ TextStorage ***************/
+
+TextStorage::TextStorage() : references(0) {
+}
+
+TextStorage::~TextStorage() {
+}
+
+void TextStorage::retain() const {
+    references.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TextStorage::release() const {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+size_t TextStorage::live() {
+    return alive().load();
+}
+
+std::atomic<size_t>& TextStorage::alive() {
+    static std::atomic<size_t> bytes(0);
+    return bytes;
+}
+
+/************ TextRef ***************/
+
+template <class S>
+TextRef<S>::TextRef() : storage(nullptr) {
+}
+
+template <class S>
+TextRef<S>::TextRef(S* s) : storage(s) {
+    if (storage != nullptr)
+        storage->retain();
+}
+
+template <class S>
+TextRef<S>::TextRef(const TextRef& other) : TextRef(other.storage) {
+}
+
+template <class S>
+TextRef<S>::TextRef(TextRef&& other) noexcept : storage(other.storage) {
+    other.storage = nullptr;
+}
+
+template <class S>
+TextRef<S>::~TextRef() {
+    if (storage != nullptr)
+        storage->release();
+}
+
+template <class S>
+TextRef<S>& TextRef<S>::operator = (const TextRef& other) {
+    if (other.storage != nullptr)
+        other.storage->retain();
+    if (storage != nullptr)
+        storage->release();
+    storage = other.storage;
+    return *this;
+}
+
+template <class S>
+TextRef<S>& TextRef<S>::operator = (TextRef&& other) noexcept {
+    std::swap(storage, other.storage);
+    return *this;
+}
+
+template <class S>
+S* TextRef<S>::get() const {
+    return storage;
+}
+
+template <class S>
+S& TextRef<S>::operator * () const {
+    return *storage;
+}
+
+template <class S>
+S* TextRef<S>::operator -> () const {
+    return storage;
+}
+
+/************ TextBlock ***************/
+
+/*
+ * The characters follow the block in the same allocation.
+ */
+TextBlock* TextBlock::create(std::string_view a, std::string_view b, Text& first, Text& second) {
+    if (a.empty() && b.empty()) {
+        first = Text();
+        second = Text();
+        return nullptr;
+    }
+    size_t bytes = sizeof(TextBlock) + Text::footprint(a.size()) + Text::footprint(b.size());
+    TextBlock* block = new (::operator new(bytes)) TextBlock(bytes);
+    char* area = reinterpret_cast<char*>(block + 1);
+    first = Text::write(area, a);
+    second = Text::write(area + Text::footprint(a.size()), b);
+    return block;
+}
+
+void TextBlock::operator delete(void* p) {
+    ::operator delete(p);
+}
+
+TextBlock::TextBlock(size_t b) : bytes(b) {
+    alive() += bytes;
+}
+
+TextBlock::~TextBlock() {
+    alive() -= bytes;
+}
+
+/************ TextArena ***************/
+
+TextArena::TextArena() : total(0), writer(*this) {
+}
+
+TextArena::~TextArena() {
+    alive() -= total.load();
+}
+
+Text TextArena::intern(std::string_view s) {
+    std::lock_guard<std::mutex> guard(writing);
+    return writer.intern(s);
+}
+
+Text TextArena::store(std::string_view s) {
+    std::lock_guard<std::mutex> guard(writing);
+    return writer.store(s);
+}
+
+TextRef<TextStorage> TextArena::reference() {
+    return TextRef<TextStorage>(this);
+}
+
+size_t TextArena::reserved() const {
+    return total.load();
+}
+
+TextRef<TextStorage> TextArena::counted(TextStorage* storage) {
+    TextRef<TextStorage> ref;
+    ref.storage = storage;
+    return ref;
+}
+
+char* TextArena::allocate(size_t length) {
+    std::unique_ptr<char[]> chunk(new char[length]);
+    char* begin = chunk.get();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        chunks.push_back(std::move(chunk));
+    }
+    total += length;
+    alive() += length;
+    return begin;
+}
+
+/************ TextArena::Writer ***************/
+
+TextArena::Writer::Writer(TextArena& a) : arena(a), cursor(nullptr), limit(nullptr), reserved(0) {
+}
+
+/*
+ * The references left are given back to the arena, which is freed if no
+ * Book points into it and nobody else holds it.
+ */
+TextArena::Writer::~Writer() {
+    if (reserved > 0 && arena.references.fetch_sub(reserved, std::memory_order_acq_rel) == reserved)
+        delete &arena;
+}
+
+Text TextArena::Writer::intern(std::string_view s) {
+    if (s.empty())
+        return Text();
+    Shard& shard = arena.shards[std::hash<std::string_view>()(s) % SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::unordered_set<std::string_view>::const_iterator found = shard.strings.find(s);
+    if (found != shard.strings.end())
+        return Text(found->data());
+    const char* text = append(s);
+    shard.strings.insert(std::string_view(text, s.size()));
+    return Text(text);
+}
+
+Text TextArena::Writer::store(std::string_view s) {
+    if (s.empty())
+        return Text();
+    return Text(append(s));
+}
+
+TextRef<TextStorage> TextArena::Writer::reference() {
+    if (reserved == 0) {
+        arena.references.fetch_add(REFERENCES, std::memory_order_relaxed);
+        reserved = REFERENCES;
+    }
+    reserved--;
+    return counted(&arena);
+}
+
+/*
+ * Strings larger than a chunk get a chunk of their own.
+ */
+const char* TextArena::Writer::append(std::string_view s) {
+    size_t size = Text::footprint(s.size());
+    char* block;
+    if (size > CHUNK) {
+        block = arena.allocate(size);
+    }
+    else {
+        if (size > (size_t)(limit - cursor)) {
+            cursor = arena.allocate(CHUNK);
+            limit = cursor + CHUNK;
+        }
+        block = cursor;
+        cursor += size;
+    }
+    return Text::write(block, s).data();
+}
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * ThreadPool Class.
+ *
+ * Fixed set of worker threads with one task queue each. A worker runs
+ * the newest task of its own queue first and, when it is empty, steals
+ * the oldest task of another queue, so a task that splits its work by
+ * submitting more tasks keeps the pieces on its worker while idle
+ * workers take the large pieces left at the front of the queues.
+ */
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    /*
+     * Starts the given number of workers (default: one per core).
+     */
+    ThreadPool(unsigned threads = 0);
+    /*
+     * Waits for the pending tasks, then stops the workers.
+     */
+    ~ThreadPool();
+
+    /*
+     * Queues a task. A task submitted by a worker of the pool goes
+     * on the queue of that worker, the others are spread over the
+     * queues in turn. Tasks must not throw.
+     */
+    void submit(std::function<void()> task);
+    /*
+     * Blocks until every submitted task has finished, including the
+     * tasks they submitted. Must not be called from a task.
+     */
+    void wait();
+    unsigned size() const;
+    /*
+     * Index of the calling thread among the workers, from 0, or
+     * size() if it is not a worker of this pool.
+     */
+    unsigned worker() const;
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator = (const ThreadPool&);
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void work(unsigned);
+    /*
+     * Takes the newest task of the queue of the worker passed, or
+     * else the oldest task of another queue. Returns "false" if
+     * every queue is empty.
+     */
+    bool take(unsigned, std::function<void()>&);
+    /*
+     * Pool and index of the worker running on the calling thread.
+     */
+    static const ThreadPool*& owner();
+    static unsigned& index();
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable done;
+    /*
+     * Tasks in the queues. It is only incremented under "lock" (after
+     * the push), so a worker checking it before sleeping never misses
+     * a task; a steal may briefly take it below zero.
+     */
+    std::atomic<long> queued;
+    size_t pending;
+    unsigned next;
+    bool stopping;
+};
+
+ThreadPool::ThreadPool(unsigned threads) : queued(0), pending(0), next(0), stopping(false) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    for (unsigned i = 0; i < threads; i++)
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    for (unsigned i = 0; i < threads; i++)
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned target = worker();
+    if (target == size()) {
+        std::lock_guard<std::mutex> guard(lock);
+        target = next;
+        next = (next + 1) % size();
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending++;
+        queued++;
+    }
+    ready.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this]() { return pending == 0; });
+}
+
+unsigned ThreadPool::size() const {
+    return (unsigned)workers.size();
+}
+
+unsigned ThreadPool::worker() const {
+    return owner() == this ? index() : size();
+}
+
+const ThreadPool*& ThreadPool::owner() {
+    thread_local const ThreadPool* pool = nullptr;
+    return pool;
+}
+
+unsigned& ThreadPool::index() {
+    thread_local unsigned i = 0;
+    return i;
+}
+
+bool ThreadPool::take(unsigned self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& other = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Worker loop: runs tasks until the pool is stopped, sleeping while
+ * every queue is empty.
+ */
+void ThreadPool::work(unsigned self) {
+    owner() = this;
+    index() = self;
+    for (;;) {
+        std::function<void()> task;
+        if (!take(self, task)) {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]() { return stopping || queued > 0; });
+            if (stopping && queued <= 0)
+                return;
+            continue;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending--;
+            if (pending == 0)
+                done.notify_all();
+        }
+    }
+}
+
+#endif
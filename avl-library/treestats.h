@@ -0,0 +1,258 @@
+/*
+ * Instrumentation policies for the AVLTree class.
+ *
+ * A policy is a class Stats with the members below. The tree calls them
+ * from its operations and never looks at the counters itself.
+ *
+ * 		Scope(stats, TreeOperation)	RAII object naming the operation the
+ * 						calling thread runs until it is destroyed,
+ * 						counted as one call unless it is nested
+ * 						in a Scope of the same operation
+ * 		void compare(int)		comparisons of elements
+ * 		void visit(int)			nodes reached
+ * 		void rotate(bool)		one rebalancing, true if it is a double
+ * 						rotation
+ * 		void allocate(), free(int)	nodes constructed and destroyed
+ * 		TreeStats snapshot() const	counters so far
+ * 		void reset()			set the counters to zero
+ *
+ * NoStats does nothing and is the default. CountingStats counts each
+ * event for the operation of the innermost Scope of the thread. Defining
+ * AVL_STATISTICS makes CountingStats the default of every AVLTree.
+ */
+
+#ifndef __TREESTATS_H__
+#define __TREESTATS_H__
+
+#include <atomic>
+#include <ostream>
+
+enum TreeOperation {
+	OP_INSERT,
+	OP_REMOVE,
+	OP_LOOKUP,
+	OP_ITERATE,
+	OP_BULK,
+	TREE_OPERATIONS
+};
+
+/*
+ * Counters of one kind of operation.
+ */
+struct OperationStats {
+	unsigned long long calls;
+	unsigned long long comparisons;
+	unsigned long long visits;
+	unsigned long long rotations;
+	unsigned long long doubleRotations;
+	unsigned long long allocations;
+	unsigned long long frees;
+
+	OperationStats& operator += (const OperationStats&);
+};
+
+/*
+ * A snapshot of the counters of a tree, per kind of operation.
+ */
+struct TreeStats {
+	OperationStats operations[TREE_OPERATIONS];
+
+	OperationStats total() const;
+	static const char* name(TreeOperation);
+};
+
+/*
+ * Writes one line per kind of operation that happened.
+ */
+std::ostream& operator << (std::ostream&, const TreeStats&);
+
+class NoStats {
+public:
+	static const bool enabled = false;
+
+	class Scope {
+	public:
+		Scope(const NoStats&, TreeOperation) {
+		}
+	};
+
+	void compare(int = 1) const {
+	}
+	void visit(int = 1) const {
+	}
+	void rotate(bool) const {
+	}
+	void allocate() const {
+	}
+	void free(int = 1) const {
+	}
+	TreeStats snapshot() const {
+		return TreeStats();
+	}
+	void reset() {
+	}
+};
+
+/*
+ * The counters are relaxed atomics, so concurrent readers of a tree can
+ * count their lookups safely.
+ */
+class CountingStats {
+public:
+	static const bool enabled = true;
+
+	class Scope {
+	public:
+		Scope(const CountingStats&, TreeOperation);
+		~Scope();
+
+	private:
+		Scope(const Scope&);
+		Scope& operator = (const Scope&);
+
+		TreeOperation saved;
+	};
+
+	CountingStats();
+
+	void compare(int = 1) const;
+	void visit(int = 1) const;
+	void rotate(bool) const;
+	void allocate() const;
+	void free(int = 1) const;
+	TreeStats snapshot() const;
+	void reset();
+
+private:
+	CountingStats(const CountingStats&);
+	CountingStats& operator = (const CountingStats&);
+
+	enum Counter { CALLS, COMPARISONS, VISITS, ROTATIONS, DOUBLE_ROTATIONS, ALLOCATIONS, FREES, COUNTERS };
+
+	void add(Counter, unsigned long long) const;
+	/*
+	 * Operation of the innermost Scope of the calling thread, or
+	 * TREE_OPERATIONS outside of any Scope. Events outside of any
+	 * Scope (on threads started by the tree) count as OP_BULK.
+	 */
+	static TreeOperation& current();
+
+	mutable std::atomic<unsigned long long> counters[TREE_OPERATIONS][COUNTERS];
+};
+
+#ifdef AVL_STATISTICS
+typedef CountingStats DefaultStats;
+#else
+typedef NoStats DefaultStats;
+#endif
+
+/************ TreeStats ***************/
+
+OperationStats& OperationStats::operator += (const OperationStats& other) {
+	calls += other.calls;
+	comparisons += other.comparisons;
+	visits += other.visits;
+	rotations += other.rotations;
+	doubleRotations += other.doubleRotations;
+	allocations += other.allocations;
+	frees += other.frees;
+	return *this;
+}
+
+OperationStats TreeStats::total() const {
+	OperationStats sum = OperationStats();
+	for (int op = 0; op < TREE_OPERATIONS; op++)
+		sum += operations[op];
+	return sum;
+}
+
+const char* TreeStats::name(TreeOperation op) {
+	static const char* const NAMES[TREE_OPERATIONS] = { "insert", "remove", "lookup", "iterate", "bulk" };
+	return NAMES[op];
+}
+
+std::ostream& operator << (std::ostream& os, const TreeStats& stats) {
+	for (int op = 0; op < TREE_OPERATIONS; op++) {
+		const OperationStats& s = stats.operations[op];
+		if (s.calls == 0 && s.visits == 0 && s.allocations == 0 && s.frees == 0)
+			continue;
+		os << TreeStats::name((TreeOperation)op) << ": " << s.calls << " calls, "
+			<< s.comparisons << " comparisons, " << s.visits << " visits, "
+			<< s.rotations << " rotations (" << s.doubleRotations << " double), "
+			<< s.allocations << " allocations, " << s.frees << " frees" << std::endl;
+	}
+	return os;
+}
+
+/************ CountingStats ***************/
+
+CountingStats::Scope::Scope(const CountingStats& stats, TreeOperation op) : saved(current()) {
+	if (saved != op) {
+		current() = op;
+		stats.add(CALLS, 1);
+	}
+}
+
+CountingStats::Scope::~Scope() {
+	current() = saved;
+}
+
+CountingStats::CountingStats() {
+	reset();
+}
+
+TreeOperation& CountingStats::current() {
+	thread_local TreeOperation op = TREE_OPERATIONS;
+	return op;
+}
+
+void CountingStats::add(Counter counter, unsigned long long n) const {
+	TreeOperation op = current();
+	if (op == TREE_OPERATIONS)
+		op = OP_BULK;
+	counters[op][counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void CountingStats::compare(int n) const {
+	add(COMPARISONS, n);
+}
+
+void CountingStats::visit(int n) const {
+	add(VISITS, n);
+}
+
+void CountingStats::rotate(bool twice) const {
+	add(twice ? DOUBLE_ROTATIONS : ROTATIONS, 1);
+}
+
+void CountingStats::allocate() const {
+	add(ALLOCATIONS, 1);
+}
+
+void CountingStats::free(int n) const {
+	add(FREES, n);
+}
+
+TreeStats CountingStats::snapshot() const {
+	TreeStats stats;
+	for (int op = 0; op < TREE_OPERATIONS; op++) {
+		OperationStats& s = stats.operations[op];
+		s.calls = counters[op][CALLS].load(std::memory_order_relaxed);
+		s.comparisons = counters[op][COMPARISONS].load(std::memory_order_relaxed);
+		s.visits = counters[op][VISITS].load(std::memory_order_relaxed);
+		s.rotations = counters[op][ROTATIONS].load(std::memory_order_relaxed);
+		s.doubleRotations = counters[op][DOUBLE_ROTATIONS].load(std::memory_order_relaxed);
+		s.allocations = counters[op][ALLOCATIONS].load(std::memory_order_relaxed);
+		s.frees = counters[op][FREES].load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+void CountingStats::reset() {
+	for (int op = 0; op < TREE_OPERATIONS; op++) {
+		for (int c = 0; c < COUNTERS; c++)
+			counters[op][c].store(0, std::memory_order_relaxed);
+	}
+}
+
+#endif